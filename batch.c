@@ -0,0 +1,13 @@
+#include "fib_base.h"
+
+// Fallback for the implementations that do not provide fibonacci_batch (see
+// impl/README.md): being weak, this definition gives way to theirs at link
+// time, and otherwise computes the indices one at a time.
+__attribute__((weak))
+void fibonacci_batch(uint64_t const *const indices, size_t const count, struct number *const results)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        results[i] = fibonacci(indices[i]);
+    }
+}
@@ -0,0 +1,496 @@
+#include "dec.h"
+
+// Subquadratic binary to decimal conversion (used by hex.c --dec).
+//
+// Numbers are cut in halves by dividing them by P_k = C^(2^k), where C is the
+// largest power of ten that fits in a digit (10^19, or 10^9 with 32-bit digits):
+// the quotient holds the leading 2^k chunks of DEC_CHUNK_LEN decimal digits,
+// and the remainder the trailing 2^k chunks, both of which are then converted
+// recursively. Blocks of at most 2^DEC_BASECASE_LEVEL chunks are converted by
+// repeated short division.
+//
+// The powers P_k are computed once (by repeated squaring), along with their
+// reciprocals (by Newton's method), so that each division boils down to a
+// Barrett reduction, i.e. a couple of products through the multiplication
+// engine in impl/mul/.
+
+#if defined(DEBUG) || defined(ONLY64)
+#   define DIGIT uint32_t
+#   define DBDGT uint64_t
+#   define DEC_CHUNK 1000000000u
+#   define DEC_CHUNK_LEN 9
+#else
+#   define DIGIT uint64_t
+#   define DBDGT __uint128_t
+#   define DEC_CHUNK 10000000000000000000u
+#   define DEC_CHUNK_LEN 19
+#endif
+
+#define DIGIT_BIT (CHAR_BIT * sizeof(DIGIT))
+#define DBDGT_BIT (CHAR_BIT * sizeof(DBDGT))
+
+#include "impl/mul/mul.h"
+
+#ifndef DEC_BASECASE_LEVEL
+#   define DEC_BASECASE_LEVEL 4
+#endif
+// reciprocals of at most this many digits are computed bit by bit
+#define DEC_INVERT_BASECASE 6
+#define DEC_MAX_LEVELS 64
+
+// P_k = C^(2^k)
+struct dec_power {
+    size_t len;
+    DIGIT *power;
+    // P_k << shift has its top bit set (only past DEC_BASECASE_LEVEL)
+    unsigned shift;
+    DIGIT *divisor;
+    // floor(B^(2 len) / divisor), len + 1 digits
+    DIGIT *inverse;
+};
+
+struct dec_tree {
+    unsigned nlevels;
+    struct dec_power levels[DEC_MAX_LEVELS];
+};
+
+// decimal digits, of which only the first limit are kept
+struct dec_sink {
+    char *text;
+    size_t len;
+    size_t limit;
+    // digits emitted so far (including those past limit)
+    size_t total;
+};
+
+// (*result) = (*a) * (*b), writing exactly adigits + bdigits digits
+// (kept out of line: once mul_basecase is inlined here, gcc warns about a
+// memset of (size_t)-1 digits that cannot happen)
+__attribute__((noinline)) static void dec_mul(
+        DIGIT *restrict result,
+        DIGIT const *const a, size_t const adigits,
+        DIGIT const *const b, size_t const bdigits)
+{
+    size_t const n = adigits < bdigits ? adigits : bdigits;
+    DIGIT *const scratch = malloc(mul_scratch_len(n < NTT_THRESHOLD ? n : NTT_THRESHOLD) * sizeof(DIGIT));
+    mul(result, a, adigits, b, bdigits, scratch);
+    free(scratch);
+}
+
+// subtracts borrow from (*a), propagating it as far as necessary
+// (the caller guarantees that the result is nonnegative)
+static void sub_borrow(DIGIT *a, DIGIT borrow)
+{
+    while (borrow)
+    {
+        borrow = __builtin_sub_overflow(*a, borrow, a);
+        ++a;
+    }
+}
+
+// (*a) <<= shift (less than DIGIT_BIT), in place
+// returns the bits shifted out
+static DIGIT shift_left(DIGIT *const a, size_t const ndigits, unsigned const shift)
+{
+    DIGIT out = 0;
+    if (shift)
+    {
+        for (size_t offset = 0; offset < ndigits; ++offset)
+        {
+            DIGIT const digit = a[offset];
+            a[offset] = (digit << shift) | out;
+            out = digit >> (DIGIT_BIT - shift);
+        }
+    }
+    return out;
+}
+
+// (*a) >>= shift (less than DIGIT_BIT), in place
+static void shift_right(DIGIT *const a, size_t const ndigits, unsigned const shift)
+{
+    if (shift)
+    {
+        for (size_t offset = 0; offset + 1 < ndigits; ++offset)
+        {
+            a[offset] = (a[offset] >> shift) | (a[offset + 1] << (DIGIT_BIT - shift));
+        }
+        a[ndigits - 1] >>= shift;
+    }
+}
+
+// returns 1 if (*a) (ndigits + 1 digits long) is at most B^ndigits
+static int at_most_pow(DIGIT const *const a, size_t const ndigits)
+{
+    if (a[ndigits] != 1)
+    {
+        return !a[ndigits];
+    }
+    return normalised_len(a, ndigits) == 1 && !a[0];
+}
+
+// V = floor(B^(2m) / d) (m + 1 digits), by long division one bit at a time
+static void invert_basecase(DIGIT *restrict V, DIGIT const *const d, size_t const m)
+{
+    DIGIT *const rem = calloc(m + 1, sizeof(DIGIT));
+    memset(V, 0, (m + 1) * sizeof(DIGIT));
+    for (size_t bit = 2 * m * DIGIT_BIT + 1; bit--;)
+    {
+        shift_left(rem, m + 1, 1);
+        rem[0] |= bit == 2 * m * DIGIT_BIT;
+        if (rem[m] || geq_n(rem, d, m))
+        {
+            rem[m] -= sub_n(rem, rem, d, m);
+            // the quotient is less than B^(m + 1)
+            if (bit < (m + 1) * DIGIT_BIT)
+            {
+                V[bit / DIGIT_BIT] |= (DIGIT)1 << (bit % DIGIT_BIT);
+            }
+        }
+    }
+    free(rem);
+}
+
+// adjusts V (m + 1 digits, off by a few units) to floor(B^(2m) / d)
+static void invert_fixup(DIGIT *restrict V, DIGIT const *const d, size_t const m)
+{
+    DIGIT *const prod = malloc((2 * m + 1) * sizeof(DIGIT));
+    dec_mul(prod, V, m + 1, d, m);
+
+    // while dV > B^(2m), V -= 1
+    while (!at_most_pow(prod, 2 * m))
+    {
+        sub_borrow(&prod[m], sub_n(prod, prod, d, m));
+        sub_borrow(V, 1);
+    }
+    // while d(V + 1) <= B^(2m), V += 1
+    for (;;)
+    {
+        add_accum(prod, d, m);
+        if (!at_most_pow(prod, 2 * m))
+        {
+            break;
+        }
+        add_carry(V, 1);
+    }
+    free(prod);
+}
+
+// V = floor(B^(2m) / d) (m + 1 digits), where d has m digits, and its top bit set
+static void invert(DIGIT *restrict V, DIGIT const *const d, size_t const m)
+{
+    if (m <= DEC_INVERT_BASECASE)
+    {
+        invert_basecase(V, d, m);
+        return;
+    }
+
+    // Vh = floor(B^(2h) / dh), where dh is the top h digits of d
+    // (h is a bit more than m/2, so that a single Newton step is enough)
+    size_t const h = m / 2 + 2;
+    DIGIT *const vh = malloc((h + 1) * sizeof(DIGIT));
+    invert(vh, &d[m - h], h);
+
+    // V0 = Vh B^(m-h) approximates B^(2m) / d, and the Newton step
+    //     V = V0 + V0 (B^(2m) - d V0) / B^(2m) = V0 + Vh e / B^(2h)
+    // where e = B^(m+h) - d Vh, roughly doubles its precision
+    size_t const elen = m + h + 1;
+    DIGIT *const e = malloc(elen * sizeof(DIGIT));
+    dec_mul(e, vh, h + 1, d, m);
+    int const negative = !at_most_pow(e, m + h);
+    if (negative)
+    {
+        --e[m + h];
+    }
+    else if (e[m + h])
+    {
+        memset(e, 0, elen * sizeof(DIGIT));
+    }
+    else
+    {
+        for (size_t offset = 0; offset < m + h; ++offset)
+        {
+            e[offset] = ~e[offset];
+        }
+        add_carry(e, 1);
+    }
+    size_t const en = normalised_len(e, elen);
+
+    DIGIT *const t = malloc((h + 1 + en) * sizeof(DIGIT));
+    dec_mul(t, vh, h + 1, e, en);
+
+    memset(V, 0, (m - h) * sizeof(DIGIT));
+    memcpy(&V[m - h], vh, (h + 1) * sizeof(DIGIT));
+    if (h + 1 + en > 2 * h)
+    {
+        DIGIT const *const delta = &t[2 * h];
+        size_t const dlen = normalised_len(delta, h + 1 + en - 2 * h);
+        if (negative)
+        {
+            sub_borrow(&V[dlen], sub_n(V, V, delta, dlen));
+        }
+        else
+        {
+            add_accum(V, delta, dlen);
+        }
+    }
+
+    free(t);
+    free(e);
+    free(vh);
+    invert_fixup(V, d, m);
+}
+
+// q = floor(x / P_k) and r = x mod P_k (len digits each), for x < P_k^2
+static void divmod(
+        DIGIT *restrict q, DIGIT *restrict r,
+        DIGIT const *const x, size_t xdigits,
+        struct dec_power const *const pw)
+{
+    size_t const m = pw->len;
+    xdigits = normalised_len(x, xdigits);
+
+    // xs = x << shift (less than divisor^2, hence B^(2m))
+    DIGIT *const xs = calloc(2 * m, sizeof(DIGIT));
+    memcpy(xs, x, xdigits * sizeof(DIGIT));
+    shift_left(xs, 2 * m, pw->shift);
+
+    // Barrett: qhat = floor(floor(xs / B^(m-1)) inverse / B^(m+1)) is q, q - 1 or q - 2
+    DIGIT *const prod = malloc((2 * m + 2) * sizeof(DIGIT));
+    dec_mul(prod, &xs[m - 1], m + 1, pw->inverse, m + 1);
+    DIGIT *const qhat = &prod[m + 1];
+
+    // xs -= qhat divisor (which then fits m + 1 digits)
+    DIGIT *const t = malloc((2 * m + 1) * sizeof(DIGIT));
+    dec_mul(t, qhat, m + 1, pw->divisor, m);
+    sub_n(xs, xs, t, 2 * m);
+    while (xs[m] || geq_n(xs, pw->divisor, m))
+    {
+        xs[m] -= sub_n(xs, xs, pw->divisor, m);
+        add_carry(qhat, 1);
+    }
+
+    memcpy(q, qhat, m * sizeof(DIGIT));
+    shift_right(xs, m, pw->shift);
+    memcpy(r, xs, m * sizeof(DIGIT));
+
+    free(t);
+    free(prod);
+    free(xs);
+}
+
+// computes the powers P_k until P_k^2 exceeds B^ndigits
+// returns the level K such that numbers of ndigits digits are less than P_K
+static unsigned dec_tree_init(struct dec_tree *const tree, size_t const ndigits)
+{
+    struct dec_power *const levels = tree->levels;
+    levels[0].len = 1;
+    levels[0].power = malloc(sizeof(DIGIT));
+    levels[0].power[0] = DEC_CHUNK;
+
+    unsigned k = 0;
+    // P_k^2 >= B^(2 (len - 1))
+    for (; 2 * (levels[k].len - 1) < ndigits; ++k)
+    {
+        size_t const len = levels[k].len;
+        levels[k + 1].power = malloc(2 * len * sizeof(DIGIT));
+        dec_mul(levels[k + 1].power, levels[k].power, len, levels[k].power, len);
+        levels[k + 1].len = normalised_len(levels[k + 1].power, 2 * len);
+    }
+    tree->nlevels = k + 1;
+
+    // only the powers past DEC_BASECASE_LEVEL divide anything
+    for (unsigned j = 0; j < tree->nlevels; ++j)
+    {
+        struct dec_power *const pw = &levels[j];
+        pw->divisor = pw->inverse = NULL;
+        if (j < DEC_BASECASE_LEVEL)
+        {
+            continue;
+        }
+
+        DIGIT const top = pw->power[pw->len - 1];
+        pw->shift = 0;
+        while (!((top << pw->shift) >> (DIGIT_BIT - 1)))
+        {
+            ++pw->shift;
+        }
+        pw->divisor = malloc(pw->len * sizeof(DIGIT));
+        memcpy(pw->divisor, pw->power, pw->len * sizeof(DIGIT));
+        shift_left(pw->divisor, pw->len, pw->shift);
+        pw->inverse = malloc((pw->len + 1) * sizeof(DIGIT));
+        invert(pw->inverse, pw->divisor, pw->len);
+    }
+    return tree->nlevels;
+}
+
+static void dec_tree_free(struct dec_tree *const tree)
+{
+    for (unsigned j = 0; j < tree->nlevels; ++j)
+    {
+        free(tree->levels[j].power);
+        free(tree->levels[j].divisor);
+        free(tree->levels[j].inverse);
+    }
+}
+
+static void emit(struct dec_sink *const sink, char const *const digits, size_t const ndigits)
+{
+    size_t const room = sink->limit - sink->len;
+    size_t const keep = ndigits < room ? ndigits : room;
+    memcpy(&sink->text[sink->len], digits, keep);
+    sink->len += keep;
+    sink->total += ndigits;
+}
+
+// emits (*x) (less than C^nchunks) as nchunks chunks of DEC_CHUNK_LEN digits,
+// by repeated short division (without the leading zeroes, if strip is set)
+static void convert_basecase(
+        struct dec_sink *const sink,
+        DIGIT const *const x, size_t xdigits, size_t const nchunks, int const strip)
+{
+    DIGIT *const tmp = malloc(xdigits * sizeof(DIGIT));
+    memcpy(tmp, x, xdigits * sizeof(DIGIT));
+    size_t const len = nchunks * DEC_CHUNK_LEN;
+    char *const text = malloc(len);
+
+    for (size_t chunk = nchunks; chunk--;)
+    {
+        DBDGT rem = 0;
+        for (size_t offset = xdigits; offset--;)
+        {
+            DBDGT const cur = (rem << DIGIT_BIT) | tmp[offset];
+            tmp[offset] = (DIGIT)(cur / DEC_CHUNK);
+            rem = cur % DEC_CHUNK;
+        }
+        xdigits = normalised_len(tmp, xdigits);
+
+        DIGIT value = (DIGIT)rem;
+        for (size_t i = DEC_CHUNK_LEN; i--;)
+        {
+            text[chunk * DEC_CHUNK_LEN + i] = '0' + value % 10;
+            value /= 10;
+        }
+    }
+
+    size_t skip = 0;
+    while (strip && skip + 1 < len && text[skip] == '0')
+    {
+        ++skip;
+    }
+    emit(sink, &text[skip], len - skip);
+
+    free(text);
+    free(tmp);
+}
+
+// emits (*x) (less than P_k) as 2^k chunks of DEC_CHUNK_LEN digits
+static void convert(
+        struct dec_sink *const sink,
+        DIGIT const *const x, size_t const xdigits,
+        unsigned const k, struct dec_tree const *const tree)
+{
+    if (sink->len == sink->limit)
+    {
+        // the digits are only counted
+        sink->total += (size_t)DEC_CHUNK_LEN << k;
+        return;
+    }
+    if (k <= DEC_BASECASE_LEVEL)
+    {
+        convert_basecase(sink, x, normalised_len(x, xdigits), (size_t)1 << k, 0);
+        return;
+    }
+
+    struct dec_power const *const pw = &tree->levels[k - 1];
+    DIGIT *const q = malloc(2 * pw->len * sizeof(DIGIT));
+    DIGIT *const r = &q[pw->len];
+    divmod(q, r, x, xdigits, pw);
+    convert(sink, q, pw->len, k - 1, tree);
+    convert(sink, r, pw->len, k - 1, tree);
+    free(q);
+}
+
+// emits (*x) (less than P_k) without leading zeroes
+static void convert_top(
+        struct dec_sink *const sink,
+        DIGIT const *const x, size_t xdigits,
+        unsigned const k, struct dec_tree const *const tree)
+{
+    xdigits = normalised_len(x, xdigits);
+    if (k <= DEC_BASECASE_LEVEL)
+    {
+        convert_basecase(sink, x, xdigits, (size_t)1 << k, 1);
+        return;
+    }
+
+    struct dec_power const *const pw = &tree->levels[k - 1];
+    if (xdigits < pw->len || (xdigits == pw->len && !geq_n(x, pw->power, xdigits)))
+    {
+        convert_top(sink, x, xdigits, k - 1, tree);
+        return;
+    }
+
+    DIGIT *const q = malloc(2 * pw->len * sizeof(DIGIT));
+    DIGIT *const r = &q[pw->len];
+    divmod(q, r, x, xdigits, pw);
+    convert_top(sink, q, pw->len, k - 1, tree);
+    convert(sink, r, pw->len, k - 1, tree);
+    free(q);
+}
+
+struct dec_job {
+    struct dec_sink *sink;
+    DIGIT const *x;
+    size_t xdigits;
+};
+
+static void dec_task(void *const arg, size_t const index)
+{
+    (void)index;
+    struct dec_job const *const job = arg;
+    struct dec_tree tree;
+    unsigned const nlevels = dec_tree_init(&tree, job->xdigits);
+    convert_top(job->sink, job->x, job->xdigits, nlevels, &tree);
+    dec_tree_free(&tree);
+}
+
+void fprint_dec(FILE *const output_file, struct number const num, size_t const ndigits)
+{
+    size_t xdigits = (num.length + sizeof(DIGIT) - 1) / sizeof(DIGIT);
+    DIGIT *const x = calloc(xdigits ? xdigits : 1, sizeof(DIGIT));
+    memcpy(x, num.bytes, num.length);
+    xdigits = normalised_len(x, xdigits ? xdigits : 1);
+
+    // log10(2) < 0.30103; past the first ndigits + 1 digits, they are only counted
+    size_t const max_len = xdigits * DIGIT_BIT * 30103 / 100000 + 1;
+    struct dec_sink sink = {
+        .limit = ndigits && ndigits + 1 < max_len ? ndigits + 1 : max_len,
+    };
+    sink.text = malloc(sink.limit);
+
+    struct dec_job job = { .sink = &sink, .x = x, .xdigits = xdigits };
+#ifdef FIB_THREADS
+    // the products spawn their subproducts into the pool
+    struct pool pool;
+    pool_init(&pool, FIB_THREADS);
+    pool_run(&pool, dec_task, &job, 1);
+    pool_free(&pool);
+#else
+    dec_task(&job, 0);
+#endif
+
+    if (!ndigits || sink.total <= ndigits)
+    {
+        fwrite(sink.text, 1, sink.len, output_file);
+    }
+    else
+    {
+        fputc(sink.text[0], output_file);
+        fputc('.', output_file);
+        fwrite(&sink.text[1], 1, ndigits, output_file);
+        fprintf(output_file, "e%zu", sink.total - 1);
+    }
+
+    free(sink.text);
+    free(x);
+}
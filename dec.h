@@ -0,0 +1,14 @@
+#ifndef DEC_H
+#define DEC_H
+
+#include <stdio.h>
+
+#include "fib_base.h"
+
+// Writes the decimal expansion of num to output_file.
+// If ndigits is nonzero, and num has more than ndigits decimal digits, only its
+// first ndigits + 1 digits are written, as d.ddd...e<exponent> (mirroring the
+// --ndigits option of scripts/hex2dec.py).
+void fprint_dec(FILE *output_file, struct number num, size_t ndigits);
+
+#endif//DEC_H
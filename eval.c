@@ -1,85 +1,296 @@
+// for sched_setaffinity and the CPU_* macros
+#define _GNU_SOURCE
+
 #include "fib_base.h"
+#include "verify.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdio.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 #include <time.h>
-#include <pthread.h>
+#include <unistd.h>
 
 #define FIRST_CHECKPOINT 93 // F(93) is the largest 64-bit Fibonacci number
 #define SECOND_CHECKPOINT 0x2d7 // W Y S I
 
-#define SOFT_CUTOFF_SEC 1
-#define SOFT_CUTOFF_NSEC 500000000
-#define HARD_CUTOFF_SEC 1
-#define HARD_CUTOFF_NSEC 0
+#define SOFT_CUTOFF 1.5
+#define HARD_CUTOFF 1.0
 
-#define SLEEP_DURATION_NSEC 1000
-#define THREAD_TIMEOUT_SEC 5
-#define THREAD_TIMEOUT_NSEC 0
+#define TIMEOUT_SEC 5
+// most points of a sweep measured at once (see --cpus)
+#define MAX_CPUS 256
 
 // log of the number of samples to take
 #ifndef SAMPLE_LOG
 #   define SAMPLE_LOG 10
 #endif
 
-struct timespec soft_cutoff = { SOFT_CUTOFF_SEC, SOFT_CUTOFF_NSEC };
-struct timespec hard_cutoff = { HARD_CUTOFF_SEC, HARD_CUTOFF_NSEC };
+// (math.h does not mix with the log macro of fib_base.h, hence the builtins
+// for sqrt and infinity)
+
+#define FORMAT_TEXT 0
+#define FORMAT_CSV 1
+#define FORMAT_JSON 2
+
+double soft_cutoff = SOFT_CUTOFF;
+double hard_cutoff = HARD_CUTOFF;
+
+// benchmark options (see usage)
+unsigned warmup = 0;
+unsigned reps = 1;
+unsigned timeout = TIMEOUT_SEC;
+unsigned long memory_limit = 0; // MiB (0 for none)
+int format = FORMAT_TEXT;
+// results failing verification (see verify.h) fail the sweep
+static char const wrong_result[] = "wrong result";
+unsigned nwrong = 0;
+uint64_t wrong_index;
+// CPUs the measurements are pinned to (none: not pinned, one at a time)
+unsigned ncpus = 0;
+int cpus[MAX_CPUS];
+// pool of CPUs shared with concurrent sweeps (see --cpu-pool), or -1
+int cpu_pool = -1;
+
+// Each run computes F(index) in a child process of its own, with its own
+// heap, under RLIMIT_AS (--memory) and RLIMIT_CPU (a little over --timeout
+// for each thread the implementation may run, as the limit adds up the CPU
+// time of all of them); the child only sends back the measurements and the
+// lowest digits of the result, while the parent waits (in poll, with the
+// timeout) for the report, kills the child if it does not come, and collects
+// its resource usage.
+struct fibonacci_report {
+    struct timespec duration; // CPU time of the computing thread
+    struct timespec wall;
+    uint64_t length;
+    uint64_t low; // least significant 64 bits of the result
+    int verified; // whether the result passed verify_fibonacci
+};
+
+struct fibonacci_run {
+    struct fibonacci_report report;
+    struct rusage usage;
+    char const *failure; // NULL if the run completed
+};
+
+// summary of the (seconds) samples of one measurement
+struct stats {
+    double min;
+    double median;
+    double p90;
+    double mean;
+    double stddev;
+};
+
+struct measurement {
+    uint64_t index;
+    uint64_t length;
+    uint64_t low;
+    unsigned nsamples;
+    struct stats cpu;
+    struct stats wall;
+    // worst over the measured runs
+    long long unsigned max_rss; // KiB
+    long long unsigned minor_faults;
+    long long unsigned major_faults;
+    char const *failure;
+};
+
+void report_begin(void);
+void report(struct measurement const *const m);
+void report_end(void);
+struct fibonacci_run run_fibonacci(uint64_t index);
+struct measurement measure_fibonacci(uint64_t index, double limit);
+
+// With --cpus, the points of the sweep are measured concurrently: each index
+// gets a worker process (measuring all of its runs), pinned to one of the
+// CPUs, with at most one worker per CPU; the measurements are read back in
+// the order of the indices, so the output is the same as a serial sweep.
+// Workers run ahead of the one being read by up to ncpus - 1 indices, and
+// are killed (with their runs) when the sweep stops before them.
+// With --cpu-pool, the CPUs come from a pool shared with the sweeps of other
+// implementations (see scripts/sweep.py) rather than from the list: a FIFO
+// holding one token (a 16-bit CPU number) per free CPU. Every point, serial
+// or not, takes a CPU from the pool for all of its runs, and gives it back
+// once read; the list still bounds how far the workers run ahead.
+struct worker {
+    pid_t pid;
+    int fd;
+    int cpu;
+};
 
-struct fibonacci_args {
-    long long unsigned index;
-    struct number result;
-    struct timespec duration;
-    int thread_completed;
+struct pipeline {
+    uint64_t first;
+    uint64_t step;
+    uint64_t last;
+    double limit;
+    unsigned begun; // indices handed to workers
+    unsigned done; // measurements read back
+    struct worker workers[MAX_CPUS];
 };
 
-int less(struct timespec const *const lhs, struct timespec const *const rhs);
-void report(struct fibonacci_args const *const args);
-void *measure_fibonacci_call(void *fib_args);
-struct fibonacci_args evaluate_fibonacci(uint64_t index);
+int select_cpus(char const *list);
+int open_cpu_pool(char const *path);
+struct measurement measure_pinned(uint64_t index, double limit);
+void pipeline_start(struct pipeline *p, uint64_t first, uint64_t step, uint64_t last, double limit);
+struct measurement pipeline_next(struct pipeline *p);
+void pipeline_stop(struct pipeline *p);
 
-int main()
+int main(int argc, char *argv[])
 {
+    char *const program = argv[0];
+    char *endptr;
+
+    // --warmup=n: discarded runs before the measured ones
+    // --reps=n: measured runs per index (reported as min/median/p90/mean/stddev)
+    // --timeout=sec: give up on an index after sec seconds (per run)
+    // --memory=mib: address space limit of each run
+    // --cpus=list|auto: CPUs to pin the runs to, measuring the points of the
+    //     sweep in parallel (auto: isolated CPUs if any, else the allowed ones)
+    // --cpu-pool=path: FIFO of CPUs shared with concurrent sweeps (along with
+    //     --cpus, listing them), see scripts/sweep.py
+    // --format=text|csv|json: text is the table read by scripts/anim.py
+    for (; argc > 1 && strncmp(argv[1], "--", 2) == 0; ++argv, --argc)
+    {
+        char const *const option = argv[1];
+        char const *const value = strchr(option, '=');
+        unsigned long number = value ? strtoul(&value[1], &endptr, 10) : 0;
+        int valid = value && value[1] != '\0';
+        if (strncmp(option, "--format=", 9) == 0)
+        {
+            format = strcmp(&option[9], "text") == 0 ? FORMAT_TEXT
+                : strcmp(&option[9], "csv") == 0 ? FORMAT_CSV
+                : strcmp(&option[9], "json") == 0 ? FORMAT_JSON
+                : -1;
+            valid = format >= 0;
+        }
+        else if (valid && *endptr == '\0' && strncmp(option, "--warmup=", 9) == 0)
+        {
+            warmup = number;
+        }
+        else if (valid && *endptr == '\0' && number > 0 && strncmp(option, "--reps=", 7) == 0)
+        {
+            reps = number;
+        }
+        else if (valid && *endptr == '\0' && number > 0 && strncmp(option, "--timeout=", 10) == 0)
+        {
+            timeout = number;
+        }
+        else if (valid && *endptr == '\0' && strncmp(option, "--memory=", 9) == 0)
+        {
+            memory_limit = number;
+        }
+        else if (valid && strncmp(option, "--cpus=", 7) == 0)
+        {
+            valid = select_cpus(&option[7]);
+        }
+        else if (valid && strncmp(option, "--cpu-pool=", 11) == 0)
+        {
+            valid = open_cpu_pool(&option[11]);
+        }
+        else
+        {
+            valid = 0;
+        }
+        if (!valid)
+        {
+            fprintf(stderr,
+                "Failed to interpret %s as an option.\n"
+                "Usage: %s [--warmup=n] [--reps=n] [--timeout=sec] [--memory=mib] [--cpus=list|auto] [--cpu-pool=path] [--format=text|csv|json] [index...]\n",
+                option, program);
+            return EXIT_FAILURE;
+        }
+    }
+    if (cpu_pool >= 0 && !ncpus)
+    {
+        fprintf(stderr, "--cpu-pool needs the list of its CPUs (--cpus).\n");
+        return EXIT_FAILURE;
+    }
+
+    if (ncpus)
+    {
+        // the serial parts (and each worker, later on) run pinned
+        // (with a shared pool, to whichever CPU they take from it)
+        if (cpu_pool < 0)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[0], &set);
+            sched_setaffinity(0, sizeof(set), &set);
+        }
+        fprintf(stderr, "# Measuring on %u CPU%s%s:", ncpus, ncpus > 1 ? "s" : "", cpu_pool >= 0 ? " (shared)" : "");
+        for (unsigned i = 0; i < ncpus; ++i)
+        {
+            fprintf(stderr, " %d", cpus[i]);
+        }
+        fputc('\n', stderr);
+    }
+
+    report_begin();
+
+    // given indices: only measure those
+    if (argc > 1)
+    {
+        int status = EXIT_SUCCESS;
+        for (int arg = 1; arg < argc; ++arg)
+        {
+            uint64_t const index = strtoull(argv[arg], &endptr, 10);
+            if (*endptr != '\0')
+            {
+                fprintf(stderr, "Failed to interpret %s as an integer.\n", argv[arg]);
+                status = EXIT_FAILURE;
+                break;
+            }
+            struct measurement const m = measure_pinned(index, __builtin_inf());
+            if (m.failure)
+            {
+                fprintf(stderr, "# Failed on %llu: %s.\n", (long long unsigned)index, m.failure);
+                status = EXIT_FAILURE;
+                break;
+            }
+            report(&m);
+        }
+        report_end();
+        return status;
+    }
+
     uint64_t cur_idx = 0;
     uint64_t best_idx = 0;
-
-    puts(
-        "#   Fibonacci index  |   Time (s)   | Size (bytes) \n"
-        "# -------------------+--------------+--------------"
-    );
+    struct pipeline sweep = { .begun = 0, .done = 0 };
 
     // FIRST CHECKPOINT
     // (verify correctness against linear algorithm)
     {
         uint64_t a = 0, b = 1, tmp;
 
+        pipeline_start(&sweep, cur_idx, 1, FIRST_CHECKPOINT, soft_cutoff);
         for (; cur_idx <= FIRST_CHECKPOINT; ++cur_idx)
         {
-            struct fibonacci_args args = evaluate_fibonacci(cur_idx);
-            if (!args.thread_completed || !less(&args.duration, &soft_cutoff))
+            struct measurement const m = pipeline_next(&sweep);
+            if (m.failure || !(m.cpu.median < soft_cutoff))
             {
-                free(args.result.bytes);
                 goto print_result;
             }
 
-            uint64_t result = *(uint64_t *)args.result.bytes;
-            if (args.result.length < sizeof(uint64_t))
-            {
-                result &= (1ull << (args.result.length * CHAR_BIT)) - 1;
-            }
+            uint64_t const result = m.low;
             if (result != a)
             {
                 fprintf(stderr, "Failed to correctly compute F(%llu).\nExpected %llu, but received %llu.\n",
                     (long long unsigned)cur_idx, (long long unsigned)a, (long long unsigned)result
                 );
+                pipeline_stop(&sweep);
                 return EXIT_FAILURE;
             }
-            report(&args);
-            if (less(&args.duration, &hard_cutoff))
+            report(&m);
+            if (m.cpu.median < hard_cutoff)
             {
                 best_idx = cur_idx;
             }
 
-            free(args.result.bytes);
-
             tmp = a + b;
             a = b;
             b = tmp;
@@ -88,17 +299,17 @@ int main()
 
     // SECOND CHECKPOINT
     {
+        pipeline_start(&sweep, cur_idx, 1, SECOND_CHECKPOINT, soft_cutoff);
         for (; cur_idx <= SECOND_CHECKPOINT; ++cur_idx)
         {
-            struct fibonacci_args args = evaluate_fibonacci(cur_idx);
-            free(args.result.bytes);
-            if (!args.thread_completed || !less(&args.duration, &soft_cutoff))
+            struct measurement const m = pipeline_next(&sweep);
+            if (m.failure || !(m.cpu.median < soft_cutoff))
             {
                 goto print_result;
             }
 
-            report(&args);
-            if (less(&args.duration, &hard_cutoff))
+            report(&m);
+            if (m.cpu.median < hard_cutoff)
             {
                 best_idx = cur_idx;
             }
@@ -108,9 +319,8 @@ int main()
     // search for upper bound
     do
     {
-        struct fibonacci_args args = evaluate_fibonacci(cur_idx);
-        free(args.result.bytes);
-        if (!args.thread_completed || !less(&args.duration, &hard_cutoff))
+        struct measurement const m = measure_pinned(cur_idx, hard_cutoff);
+        if (m.failure || !(m.cpu.median < hard_cutoff))
         {
             break;
         }
@@ -131,17 +341,17 @@ int main()
         if (delta == 0) { delta = 1; }
 
         cur_idx = SECOND_CHECKPOINT;
+        pipeline_start(&sweep, cur_idx + delta, delta, UINT64_MAX, soft_cutoff);
         do
         {
             cur_idx += delta;
-            struct fibonacci_args args = evaluate_fibonacci(cur_idx);
-            free(args.result.bytes);
-            if (cur_idx > best_idx && (!args.thread_completed || !less(&args.duration, &soft_cutoff)))
+            struct measurement const m = pipeline_next(&sweep);
+            if (m.failure == wrong_result || (cur_idx > best_idx && (m.failure || !(m.cpu.median < soft_cutoff))))
             {
                 break;
             }
-            report(&args);
-            if (cur_idx > best_idx && less(&args.duration, &hard_cutoff))
+            report(&m);
+            if (cur_idx > best_idx && m.cpu.median < hard_cutoff)
             {
                 best_idx = cur_idx;
             }
@@ -151,95 +361,655 @@ int main()
 
 print_result:
 
+    pipeline_stop(&sweep);
+    report_end();
+    if (nwrong)
+    {
+        fprintf(stderr, "Failed to correctly compute F(%llu) (modular check).\n",
+            (long long unsigned)wrong_index);
+        return EXIT_FAILURE;
+    }
     fprintf(stderr, "# Recorded best: %llu\n",
             (long long unsigned)best_idx);
 
     return EXIT_SUCCESS;
 }
 
-int less(struct timespec const *const lhs, struct timespec const *const rhs)
+static double seconds(struct timespec const *const t)
 {
-    return lhs->tv_sec < rhs->tv_sec
-        || (lhs->tv_sec == rhs->tv_sec && lhs->tv_nsec < rhs->tv_nsec);
+    return t->tv_sec + t->tv_nsec * 1e-9;
 }
 
-void report(struct fibonacci_args const *const args)
+static int compare_doubles(void const *lhs, void const *rhs)
 {
-    printf("%20llu | %llu.%09llus | %llu B\n",
-        (long long unsigned)args->index,
-        (long long unsigned)args->duration.tv_sec,
-        (long long unsigned)args->duration.tv_nsec,
-        (long long unsigned)args->result.length
-    );
+    double const l = *(double const *)lhs;
+    double const r = *(double const *)rhs;
+    return (l > r) - (l < r);
 }
 
-void *measure_fibonacci_call(void *fib_args)
+// summarises (and sorts) the nsamples (> 0) samples
+static struct stats summarise(double *const samples, unsigned const nsamples)
 {
-    struct fibonacci_args *args = fib_args;
+    qsort(samples, nsamples, sizeof(double), compare_doubles);
 
-    struct timespec start_time;
+    double sum = 0;
+    for (unsigned i = 0; i < nsamples; ++i)
+    {
+        sum += samples[i];
+    }
+    double const mean = sum / nsamples;
+    double squares = 0;
+    for (unsigned i = 0; i < nsamples; ++i)
+    {
+        squares += (samples[i] - mean) * (samples[i] - mean);
+    }
+
+    return (struct stats){
+        .min = samples[0],
+        .median = nsamples & 1
+            ? samples[nsamples / 2]
+            : (samples[nsamples / 2 - 1] + samples[nsamples / 2]) / 2,
+        // nearest rank
+        .p90 = samples[(9 * nsamples + 9) / 10 - 1],
+        .mean = mean,
+        .stddev = nsamples > 1 ? __builtin_sqrt(squares / (nsamples - 1)) : 0,
+    };
+}
+
+void report_begin(void)
+{
+    switch (format)
+    {
+    case FORMAT_TEXT:
+        puts(
+            "#   Fibonacci index  |   Time (s)   | Size (bytes) | Memory (KiB) \n"
+            "# -------------------+--------------+--------------+--------------"
+        );
+        break;
+    case FORMAT_CSV:
+        puts("index,size,samples,"
+            "cpu_min,cpu_median,cpu_p90,cpu_mean,cpu_stddev,"
+            "wall_min,wall_median,wall_p90,wall_mean,wall_stddev,"
+            "maxrss_kib,minflt,majflt");
+        break;
+    case FORMAT_JSON:
+        printf("{\"warmup\": %u, \"reps\": %u, \"results\": [", warmup, reps);
+        break;
+    }
+}
+
+static void report_stats_json(char const *const name, struct stats const *const s)
+{
+    printf("\"%s\": {\"min\": %.9f, \"median\": %.9f, \"p90\": %.9f, \"mean\": %.9f, \"stddev\": %.9f}",
+        name, s->min, s->median, s->p90, s->mean, s->stddev);
+}
+
+void report(struct measurement const *const m)
+{
+    static int nreported = 0;
+    switch (format)
+    {
+    case FORMAT_TEXT:
+        printf("%20llu | %.9fs | %llu B | %llu KiB\n",
+            (long long unsigned)m->index,
+            m->cpu.median,
+            (long long unsigned)m->length,
+            m->max_rss
+        );
+        break;
+    case FORMAT_CSV:
+        printf("%llu,%llu,%u,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f,%llu,%llu,%llu\n",
+            (long long unsigned)m->index, (long long unsigned)m->length, m->nsamples,
+            m->cpu.min, m->cpu.median, m->cpu.p90, m->cpu.mean, m->cpu.stddev,
+            m->wall.min, m->wall.median, m->wall.p90, m->wall.mean, m->wall.stddev,
+            m->max_rss, m->minor_faults, m->major_faults
+        );
+        break;
+    case FORMAT_JSON:
+        printf("%s\n  {\"index\": %llu, \"size\": %llu, \"samples\": %u, ",
+            nreported ? "," : "",
+            (long long unsigned)m->index, (long long unsigned)m->length, m->nsamples);
+        report_stats_json("cpu", &m->cpu);
+        printf(", ");
+        report_stats_json("wall", &m->wall);
+        printf(", \"maxrss_kib\": %llu, \"minflt\": %llu, \"majflt\": %llu}",
+            m->max_rss, m->minor_faults, m->major_faults);
+        break;
+    }
+    ++nreported;
+    // keep the output usable when the sweep is interrupted
+    fflush(stdout);
+}
+
+void report_end(void)
+{
+    if (format == FORMAT_JSON)
+    {
+        puts("\n]}");
+    }
+}
+
+static struct timespec elapsed(struct timespec const *const start, struct timespec const *const end)
+{
+    return (struct timespec){
+        .tv_sec = end->tv_sec - start->tv_sec,
+        .tv_nsec = end->tv_nsec - start->tv_nsec,
+    };
+}
+
+// body of the child process: computes F(index) under the limits, and writes
+// its report to fd
+static void run_child(uint64_t const index, int const fd)
+{
+    if (memory_limit)
+    {
+        rlim_t const bytes = (rlim_t)memory_limit << 20;
+        setrlimit(RLIMIT_AS, &(struct rlimit){ .rlim_cur = bytes, .rlim_max = bytes });
+    }
+    // backstop for the parent's timeout (SIGXCPU, then SIGKILL)
+#   ifdef FIB_THREADS
+    rlim_t const cpu_limit = (rlim_t)(timeout + 1) * FIB_THREADS;
+#   else
+    rlim_t const cpu_limit = (rlim_t)timeout + 1;
+#   endif
+    setrlimit(RLIMIT_CPU, &(struct rlimit){ .rlim_cur = cpu_limit, .rlim_max = cpu_limit + 1 });
+
+    struct timespec start_time, start_wall;
+    clock_gettime(CLOCK_MONOTONIC, &start_wall);
     clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start_time);
 
-    args->result = fibonacci(args->index);
+    struct number const result = fibonacci(index);
 
-    struct timespec end_time;
+    struct timespec end_time, end_wall;
     clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end_time);
+    clock_gettime(CLOCK_MONOTONIC, &end_wall);
 
-    args->duration.tv_sec = end_time.tv_sec - start_time.tv_sec;
-    args->duration.tv_nsec = end_time.tv_nsec - start_time.tv_nsec;
-    args->thread_completed = 1;
-    return NULL;
+    if (!result.bytes)
+    {
+        _exit(EXIT_FAILURE);
+    }
+
+    // (outside of the timed section, and only a single pass over the result)
+    struct fibonacci_report report = {
+        .duration = elapsed(&start_time, &end_time),
+        .wall = elapsed(&start_wall, &end_wall),
+        .length = result.length,
+        .low = 0,
+        .verified = verify_fibonacci(index, result),
+    };
+    memcpy(&report.low, result.bytes,
+        result.length < sizeof(report.low) ? result.length : sizeof(report.low));
+
+    // the report is far below PIPE_BUF, so this write is all-or-nothing
+    _exit(write(fd, &report, sizeof(report)) == sizeof(report) ? EXIT_SUCCESS : EXIT_FAILURE);
 }
 
-struct fibonacci_args evaluate_fibonacci(uint64_t index)
+// runs F(index) in a child process, killed after timeout seconds
+struct fibonacci_run run_fibonacci(uint64_t index)
 {
-    struct fibonacci_args args = {
+    struct fibonacci_run run = { .failure = "could not start" };
+
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        return run;
+    }
+    // the child inherits the buffers
+    fflush(stdout);
+    fflush(stderr);
+    pid_t const pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        run_child(index, fds[1]);
+    }
+    close(fds[1]);
+    if (pid < 0)
+    {
+        close(fds[0]);
+        return run;
+    }
+
+    // wait for the report (or the end of the child, which closes the pipe)
+    struct timespec now, deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout;
+    int ready;
+    do
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double const left = seconds(&deadline) - seconds(&now);
+        ready = left > 0
+            ? poll(&(struct pollfd){ .fd = fds[0], .events = POLLIN }, 1, (int)(left * 1000) + 1)
+            : 0;
+    }
+    while (ready < 0 && errno == EINTR);
+
+    ssize_t received = 0;
+    if (ready > 0)
+    {
+        do
+        {
+            received = read(fds[0], &run.report, sizeof(run.report));
+        }
+        while (received < 0 && errno == EINTR);
+    }
+    else
+    {
+        kill(pid, SIGKILL);
+    }
+    close(fds[0]);
+
+    int status;
+    while (wait4(pid, &status, 0, &run.usage) < 0 && errno == EINTR)
+    {
+    }
+
+    if (ready <= 0)
+    {
+        run.failure = "timed out";
+    }
+    else if (received == sizeof(run.report) && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS)
+    {
+        run.failure = NULL;
+    }
+    else if (WIFSIGNALED(status) && WTERMSIG(status) == SIGXCPU)
+    {
+        run.failure = "out of CPU time";
+    }
+    else if (memory_limit)
+    {
+        // allocations failing under RLIMIT_AS usually end in a crash
+        run.failure = "crashed or ran out of memory";
+    }
+    else
+    {
+        run.failure = "crashed";
+    }
+    return run;
+}
+
+// runs F(index) warmup + reps times, and summarises the measured runs
+// (runs slower than limit seconds end the measurement early, as the sweep
+// stops there anyway)
+struct measurement measure_fibonacci(uint64_t index, double const limit)
+{
+    struct measurement m = {
         .index = index,
-        .result = {
-            .bytes = NULL,
-            .length = 0,
-        },
-        .duration = {
-            .tv_sec = 0,
-            .tv_nsec = 0,
-        },
-        .thread_completed = 0,
+        .nsamples = 0,
     };
+    double *const cpu = malloc(2 * reps * sizeof(double));
+    double *const wall = &cpu[reps];
 
-    pthread_t thread;
-    pthread_create(&thread, NULL, measure_fibonacci_call, &args);
+    for (unsigned run = 0; run < warmup + reps; ++run)
+    {
+        struct fibonacci_run const r = run_fibonacci(index);
+        if (!r.failure && !r.report.verified)
+        {
+            if (!nwrong++)
+            {
+                wrong_index = index;
+            }
+            m.failure = wrong_result;
+            free(cpu);
+            return m;
+        }
+        if (r.failure)
+        {
+            m.failure = r.failure;
+            free(cpu);
+            return m;
+        }
+        m.length = r.report.length;
+        m.low = r.report.low;
+        if (run >= warmup)
+        {
+            cpu[m.nsamples] = seconds(&r.report.duration);
+            wall[m.nsamples] = seconds(&r.report.wall);
+            ++m.nsamples;
+            // ru_maxrss is in KiB on Linux
+            if ((long long unsigned)r.usage.ru_maxrss > m.max_rss)
+            {
+                m.max_rss = r.usage.ru_maxrss;
+            }
+            if ((long long unsigned)r.usage.ru_minflt > m.minor_faults)
+            {
+                m.minor_faults = r.usage.ru_minflt;
+            }
+            if ((long long unsigned)r.usage.ru_majflt > m.major_faults)
+            {
+                m.major_faults = r.usage.ru_majflt;
+            }
+        }
+        if (!(seconds(&r.report.duration) < limit))
+        {
+            break;
+        }
+    }
 
-    struct timespec cutoff_time;
-    clock_gettime(CLOCK_MONOTONIC, &cutoff_time);
-    cutoff_time.tv_sec += THREAD_TIMEOUT_SEC;
-    cutoff_time.tv_nsec += THREAD_TIMEOUT_NSEC;
+    if (m.nsamples)
+    {
+        m.cpu = summarise(cpu, m.nsamples);
+        m.wall = summarise(wall, m.nsamples);
+    }
+    else
+    {
+        // only warmup runs, which were already too slow
+        m.cpu.median = m.wall.median = __builtin_inf();
+    }
+    free(cpu);
+    return m;
+}
 
-    struct timespec cur_time;
+// reads a list of CPUs such as "0-3,6" (as in /sys/devices/system/cpu);
+// returns the number of CPUs in it, or 0 if it is not such a list
+static int parse_cpu_list(char const *list, cpu_set_t *const set)
+{
+    CPU_ZERO(set);
+    unsigned first, last;
+    int used;
+    while (sscanf(list, "%u%n", &first, &used) == 1)
+    {
+        list += used;
+        last = first;
+        if (*list == '-' && sscanf(&list[1], "%u%n", &last, &used) == 1)
+        {
+            list += 1 + used;
+        }
+        for (unsigned cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+        {
+            CPU_SET(cpu, set);
+        }
+        if (*list != ',')
+        {
+            break;
+        }
+        ++list;
+    }
+    return *list == '\0' || *list == '\n' ? CPU_COUNT(set) : 0;
+}
 
-    static const struct timespec sleep_duration = { 0, SLEEP_DURATION_NSEC };
-    do
+static int read_cpu_list(char const *const path, cpu_set_t *const set)
+{
+    char list[4096] = "";
+    FILE *const file = fopen(path, "r");
+    if (file)
+    {
+        if (!fgets(list, sizeof(list), file))
+        {
+            list[0] = '\0';
+        }
+        fclose(file);
+    }
+    return parse_cpu_list(list, set);
+}
+
+// sets cpus to the given list (or to the isolated, else allowed, CPUs for
+// "auto"), keeping a single hardware thread of each core, as SMT siblings
+// would slow each other down; returns 0 if there is no such CPU
+int select_cpus(char const *const list)
+{
+    cpu_set_t candidates;
+    if (strcmp(list, "auto") == 0)
+    {
+        if (!read_cpu_list("/sys/devices/system/cpu/isolated", &candidates)
+            && sched_getaffinity(0, sizeof(candidates), &candidates) != 0)
+        {
+            return 0;
+        }
+    }
+    else if (!parse_cpu_list(list, &candidates))
+    {
+        return 0;
+    }
+    cpu_set_t online;
+    if (read_cpu_list("/sys/devices/system/cpu/online", &online))
+    {
+        CPU_AND(&candidates, &candidates, &online);
+    }
+
+    cpu_set_t chosen;
+    CPU_ZERO(&chosen);
+    ncpus = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && ncpus < MAX_CPUS; ++cpu)
+    {
+        if (!CPU_ISSET(cpu, &candidates))
+        {
+            continue;
+        }
+        char path[64];
+        cpu_set_t siblings;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+        if (read_cpu_list(path, &siblings))
+        {
+            CPU_AND(&siblings, &siblings, &chosen);
+            if (CPU_COUNT(&siblings))
+            {
+                continue;
+            }
+        }
+        CPU_SET(cpu, &chosen);
+        cpus[ncpus++] = cpu;
+    }
+    return ncpus > 0;
+}
+
+// opens the FIFO of free CPUs shared with other sweeps (read and written
+// alike, so that it stays open whoever else has it)
+int open_cpu_pool(char const *const path)
+{
+    cpu_pool = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    return cpu_pool >= 0;
+}
+
+// takes a CPU from the pool, waiting for one if need be; returns -1 if there
+// is none (and it should not wait)
+static int cpu_pool_take(int const wait)
+{
+    for (;;)
+    {
+        uint16_t cpu;
+        ssize_t const received = read(cpu_pool, &cpu, sizeof(cpu));
+        if (received == sizeof(cpu))
+        {
+            return cpu;
+        }
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (!wait || (received < 0 && errno != EAGAIN))
+        {
+            return -1;
+        }
+        struct pollfd ready = { .fd = cpu_pool, .events = POLLIN };
+        poll(&ready, 1, -1);
+    }
+}
+
+static void cpu_pool_give(int const cpu)
+{
+    uint16_t const token = cpu;
+    while (write(cpu_pool, &token, sizeof(token)) < 0 && errno == EINTR)
+    {
+    }
+}
+
+static void pin(int const cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+// measure_fibonacci, on a CPU of the shared pool (if any)
+struct measurement measure_pinned(uint64_t const index, double const limit)
+{
+    if (cpu_pool < 0)
+    {
+        return measure_fibonacci(index, limit);
+    }
+    int const cpu = cpu_pool_take(1);
+    if (cpu >= 0)
     {
-        nanosleep(&sleep_duration, NULL);
-        clock_gettime(CLOCK_MONOTONIC, &cur_time);
-        if (args.thread_completed)
+        pin(cpu);
+    }
+    struct measurement const m = measure_fibonacci(index, limit);
+    if (cpu >= 0)
+    {
+        cpu_pool_give(cpu);
+    }
+    return m;
+}
+
+static uint64_t pipeline_index(struct pipeline const *const p, unsigned const n)
+{
+    return p->first + n * p->step;
+}
+
+// gives the CPU of a worker back to the shared pool
+static void pipeline_release(struct worker *const w)
+{
+    if (cpu_pool >= 0 && w->cpu >= 0)
+    {
+        cpu_pool_give(w->cpu);
+    }
+    w->cpu = -1;
+}
+
+static int pipeline_full(struct pipeline const *const p)
+{
+    return p->begun - p->done >= ncpus || (uint64_t)p->begun * p->step > p->last - p->first;
+}
+
+// hands indices to workers, while there are free CPUs (from the shared pool,
+// waiting for one only when no worker is left to wait for)
+static void pipeline_fill(struct pipeline *const p)
+{
+    for (; !pipeline_full(p); ++p->begun)
+    {
+        struct worker *const w = &p->workers[p->begun % ncpus];
+        w->pid = -1;
+        w->fd = -1;
+        w->cpu = cpu_pool < 0 ? cpus[p->begun % ncpus] : cpu_pool_take(p->begun == p->done);
+        if (w->cpu < 0)
+        {
+            break;
+        }
+        int fds[2];
+        if (pipe(fds) != 0)
         {
-            pthread_join(thread, NULL);
-            return args;
+            pipeline_release(w);
+            continue;
         }
+        uint64_t const index = pipeline_index(p, p->begun);
+        fflush(stdout);
+        fflush(stderr);
+        w->pid = fork();
+        if (w->pid == 0)
+        {
+            // own process group, so that it is killed along with its runs
+            setpgid(0, 0);
+            close(fds[0]);
+            pin(w->cpu);
+
+            struct measurement const m = measure_fibonacci(index, p->limit);
+            _exit(write(fds[1], &m, sizeof(m)) == sizeof(m) ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+        close(fds[1]);
+        if (w->pid < 0)
+        {
+            close(fds[0]);
+            pipeline_release(w);
+            continue;
+        }
+        setpgid(w->pid, w->pid);
+        w->fd = fds[0];
     }
-    while (less(&cur_time, &cutoff_time));
-    // 1 second grace
+}
+
+// measures F(first), F(first + step), ... F(last), through pipeline_next
+void pipeline_start(
+        struct pipeline *const p,
+        uint64_t const first, uint64_t const step, uint64_t const last,
+        double const limit)
+{
+    pipeline_stop(p);
+    p->first = first;
+    p->step = step;
+    p->last = last;
+    p->limit = limit;
+    p->begun = p->done = 0;
+    pipeline_fill(p);
+}
 
-    // timeout
-    pthread_cancel(thread);
-    pthread_join(thread, NULL);
+// measurement of the next index (which must be at most last)
+struct measurement pipeline_next(struct pipeline *const p)
+{
+    uint64_t const index = pipeline_index(p, p->done);
+    if (!ncpus)
+    {
+        ++p->done;
+        return measure_fibonacci(index, p->limit);
+    }
+
+    struct worker *const w = &p->workers[p->done % ncpus];
+    struct measurement m = { .index = index, .failure = "could not start" };
+    if (w->pid > 0)
+    {
+        // meanwhile, start more workers as CPUs of the shared pool free up
+        struct pollfd ready[2] = {
+            { .fd = w->fd, .events = POLLIN },
+            { .fd = cpu_pool, .events = POLLIN },
+        };
+        while (cpu_pool >= 0 && !pipeline_full(p)
+            && poll(ready, 2, -1) >= 0 && !(ready[0].revents & (POLLIN | POLLHUP)))
+        {
+            if (ready[1].revents & POLLIN)
+            {
+                pipeline_fill(p);
+            }
+        }
+        ssize_t received;
+        do
+        {
+            received = read(w->fd, &m, sizeof(m));
+        }
+        while (received < 0 && errno == EINTR);
+        close(w->fd);
+        while (waitpid(w->pid, NULL, 0) < 0 && errno == EINTR)
+        {
+        }
+        pipeline_release(w);
+        if (received != sizeof(m))
+        {
+            m = (struct measurement){ .index = index, .failure = "worker failed" };
+        }
+        else if (m.failure == wrong_result && !nwrong++)
+        {
+            wrong_index = index;
+        }
+    }
+    ++p->done;
+    pipeline_fill(p);
+    return m;
+}
 
-    // invalidate arg values, and maybe cleanup
-    if (args.result.bytes)
+// kills the workers still running
+void pipeline_stop(struct pipeline *const p)
+{
+    for (; p->done < p->begun; ++p->done)
     {
-        free(args.result.bytes);
-        args.result.bytes = NULL;
+        struct worker *const w = &p->workers[p->done % ncpus];
+        if (w->pid > 0)
+        {
+            kill(-w->pid, SIGKILL);
+            close(w->fd);
+            while (waitpid(w->pid, NULL, 0) < 0 && errno == EINTR)
+            {
+            }
+            pipeline_release(w);
+        }
     }
-    args.thread_completed = 0;
-    return args;
 }
@@ -40,4 +40,18 @@ struct number {
 // See impl/README.md for an explanation of the function's expected behaviour.
 struct number fibonacci(uint64_t index);
 
+// results[i] = fibonacci(indices[i]) for i < count; implementations may
+// share the work between indices with common leading bits, and the others get
+// a fallback computing them one at a time (batch.c, see impl/README.md)
+void fibonacci_batch(uint64_t const *indices, size_t count, struct number *results);
+
+// upper bound on the number of bits of F_index
+static inline uint64_t fib_bits(uint64_t const index)
+{
+    // F_n <= phi^(n-1) for n > 0, and log2(phi) = 0.69424191... < 2981746315 / 2^32
+    // (so that the bound overshoots by less than one bit per 2^32 of index)
+    uint64_t const log2_phi = 2981746315u;
+    return (index >> 32) * log2_phi + ((index & 0xffffffffu) * log2_phi >> 32) + 1;
+}
+
 #endif//FIB_BASE_H
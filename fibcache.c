@@ -0,0 +1,266 @@
+#include "fibcache.h"
+#include "fibfile.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FIB_CACHE_PATH_LEN 4096
+
+static char const *fib_cache_dir(void)
+{
+    char const *const dir = getenv("FIB_CACHE");
+    return dir && *dir ? dir : NULL;
+}
+
+int fib_cache_enabled(void)
+{
+    return fib_cache_dir() != NULL;
+}
+
+unsigned fib_cache_every(void)
+{
+    char const *const every = getenv("FIB_CACHE_EVERY");
+    return every && *every ? (unsigned)strtoul(every, NULL, 10) : 0;
+}
+
+static int fib_cache_path(char *const path, uint64_t const k, size_t const digit_size)
+{
+    int const len = snprintf(path, FIB_CACHE_PATH_LEN, "%s/%llu.d%zu.pair",
+        fib_cache_dir(), (long long unsigned)k, digit_size);
+    return len > 0 && len < FIB_CACHE_PATH_LEN;
+}
+
+// maps the entry at path, and checks it against k and digit_size
+// returns 0 if it does not exist, -1 (after deleting it) if it is corrupt
+static int fib_cache_map(
+        char const *const path, uint64_t const k, size_t const digit_size, size_t const max_ndigits,
+        struct fib_cache_entry *const entry)
+{
+    int const fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return 0;
+    }
+    struct stat st;
+    size_t const map_len = fstat(fd, &st) == 0 ? (size_t)st.st_size : 0;
+    void *const map = map_len >= sizeof(struct fib_cache_header)
+        ? mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0)
+        : MAP_FAILED;
+    if (map != MAP_FAILED)
+    {
+        // hits count as uses, for eviction
+        futimens(fd, NULL);
+    }
+    close(fd);
+
+    struct fib_cache_header header = { .magic = "" };
+    if (map != MAP_FAILED)
+    {
+        memcpy(&header, map, sizeof header);
+    }
+
+    char const *error = NULL;
+    if (map == MAP_FAILED)
+    {
+        error = "truncated";
+    }
+    else if (memcmp(header.magic, FIB_CACHE_MAGIC, sizeof header.magic) || header.version != FIB_CACHE_VERSION)
+    {
+        error = "not a cache entry";
+    }
+    else if (header.k != k || header.digit_size != digit_size)
+    {
+        error = "mismatched key";
+    }
+    else if (header.header_size < sizeof header || header.header_size > map_len
+            || header.ndigits > (map_len - header.header_size) / (2 * digit_size))
+    {
+        error = "truncated";
+    }
+    else if (header.ndigits > max_ndigits)
+    {
+        // (a valid entry, only too long for the caller)
+        munmap(map, map_len);
+        return 0;
+    }
+    else
+    {
+        size_t const field_bytes = header.ndigits * digit_size;
+        uint8_t const *const fields = (uint8_t const *)map + header.header_size;
+        if (fib_crc32(0, fields, 2 * field_bytes) != header.checksum)
+        {
+            error = "checksum mismatch";
+        }
+        else
+        {
+            *entry = (struct fib_cache_entry){
+                .k = k,
+                .ndigits = header.ndigits,
+                .fields = { fields, &fields[field_bytes] },
+                .map = map,
+                .map_len = map_len,
+            };
+        }
+    }
+
+    if (error)
+    {
+        fprintf(stderr, "# Cache: discarding %s (%s).\n", path, error);
+        if (map != MAP_FAILED)
+        {
+            munmap(map, map_len);
+        }
+        unlink(path);
+        return -1;
+    }
+    return 1;
+}
+
+int fib_cache_find(
+        uint64_t const index, size_t const digit_size, size_t const max_ndigits,
+        struct fib_cache_entry *const entry)
+{
+    if (!fib_cache_enabled())
+    {
+        return 0;
+    }
+    char path[FIB_CACHE_PATH_LEN];
+    for (unsigned shift = 0; shift < 64 && index >> shift; ++shift)
+    {
+        uint64_t const k = index >> shift;
+        if (fib_cache_path(path, k, digit_size) && fib_cache_map(path, k, digit_size, max_ndigits, entry) > 0)
+        {
+            entry->shift = shift;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void fib_cache_release(struct fib_cache_entry *const entry)
+{
+    munmap(entry->map, entry->map_len);
+}
+
+struct fib_cache_file {
+    char name[256];
+    off_t size;
+    struct timespec used;
+};
+
+static int fib_cache_file_cmp(void const *lhs, void const *rhs)
+{
+    struct timespec const l = ((struct fib_cache_file const *)lhs)->used;
+    struct timespec const r = ((struct fib_cache_file const *)rhs)->used;
+    return l.tv_sec != r.tv_sec ? (l.tv_sec > r.tv_sec) - (l.tv_sec < r.tv_sec)
+        : (l.tv_nsec > r.tv_nsec) - (l.tv_nsec < r.tv_nsec);
+}
+
+// deletes the least recently used entries, until they fit in FIB_CACHE_MAX MiB
+void fib_cache_evict(void)
+{
+    static int evicted = 0;
+    if (!fib_cache_enabled() || evicted)
+    {
+        return;
+    }
+    evicted = 1;
+
+    char const *const max_mib = getenv("FIB_CACHE_MAX");
+    unsigned long long const max_bytes = (max_mib && *max_mib ? strtoull(max_mib, NULL, 10) : FIB_CACHE_MAX_MIB) << 20;
+
+    DIR *const dir = opendir(fib_cache_dir());
+    if (!dir)
+    {
+        return;
+    }
+    struct fib_cache_file *files = NULL;
+    size_t nfiles = 0, capacity = 0;
+    unsigned long long total = 0;
+    struct dirent const *dirent;
+    while ((dirent = readdir(dir)))
+    {
+        size_t const len = strlen(dirent->d_name);
+        struct stat st;
+        if (len < 5 || len >= sizeof(files->name) || strcmp(&dirent->d_name[len - 5], ".pair") != 0
+            || dirent->d_name[0] == '.' || fstatat(dirfd(dir), dirent->d_name, &st, 0) != 0)
+        {
+            continue;
+        }
+        if (nfiles == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 16;
+            struct fib_cache_file *const grown = realloc(files, capacity * sizeof(*files));
+            if (!grown)
+            {
+                break;
+            }
+            files = grown;
+        }
+        memcpy(files[nfiles].name, dirent->d_name, len + 1);
+        files[nfiles].size = st.st_size;
+        files[nfiles].used = st.st_mtim;
+        total += st.st_size;
+        ++nfiles;
+    }
+
+    if (total > max_bytes)
+    {
+        qsort(files, nfiles, sizeof(*files), fib_cache_file_cmp);
+        for (size_t file = 0; file < nfiles && total > max_bytes; ++file)
+        {
+            if (unlinkat(dirfd(dir), files[file].name, 0) == 0)
+            {
+                total -= files[file].size;
+            }
+        }
+    }
+    free(files);
+    closedir(dir);
+}
+
+void fib_cache_store(
+        uint64_t const k, size_t const digit_size,
+        void const *const prev, void const *const cur, size_t const ndigits)
+{
+    char path[FIB_CACHE_PATH_LEN];
+    char temp[FIB_CACHE_PATH_LEN + 32];
+    if (!fib_cache_enabled() || !fib_cache_path(path, k, digit_size) || access(path, F_OK) == 0)
+    {
+        return;
+    }
+    mkdir(fib_cache_dir(), 0777);
+
+    size_t const field_bytes = ndigits * digit_size;
+    struct fib_cache_header const header = {
+        .magic = FIB_CACHE_MAGIC,
+        .version = FIB_CACHE_VERSION,
+        .digit_size = digit_size,
+        .k = k,
+        .ndigits = ndigits,
+        .checksum = fib_crc32(fib_crc32(0, prev, field_bytes), cur, field_bytes),
+        .header_size = sizeof(struct fib_cache_header),
+    };
+
+    // write-then-rename, so that the entry appears whole (or not at all)
+    snprintf(temp, sizeof(temp), "%s.%ld.tmp", path, (long)getpid());
+    int const fd = open(temp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd < 0)
+    {
+        return;
+    }
+    int const written = fib_write_all(fd, &header, sizeof header)
+        && fib_write_all(fd, prev, field_bytes)
+        && fib_write_all(fd, cur, field_bytes);
+    if (close(fd) != 0 || !written || rename(temp, path) != 0)
+    {
+        unlink(temp);
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef FIBCACHE_H
+#define FIBCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Persistent cache of the states of the doubling chain (used by
+// impl/fastsquaring.c), so that repeated (or neighbouring) big indices resume
+// from the longest prefix that was already computed.
+//
+// The cache is off unless the environment variable FIB_CACHE names its
+// directory (created if needed). Each entry is one file, <k>.d<size>.pair,
+// holding the pair (F_{k-1}, F_k) as two fields of ndigits digits of size
+// bytes (in the byte order of the machine), behind a struct fib_cache_header
+// with a CRC-32 of both fields; entries are written to a temporary file, then
+// renamed into place, so that readers never see partial entries, and entries
+// that fail their checks are deleted.
+// A computation only stores its final state, and, with FIB_CACHE_EVERY=s, the
+// states of every s-th step before it (so that e.g. FIB_CACHE_EVERY=1 lets
+// index + 1 resume from index >> 1), as each stored state costs a write (and
+// a checksum) of its two fields.
+// Once the files take more than FIB_CACHE_MAX MiB (4096 by default), the
+// least recently used ones (by modification time, which hits refresh) are
+// deleted, once per process.
+
+#define FIB_CACHE_MAGIC "FIBCHAIN"
+#define FIB_CACHE_VERSION 1
+#define FIB_CACHE_MAX_MIB 4096
+
+struct fib_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t digit_size;
+    uint64_t k;
+    // digits of each field
+    uint64_t ndigits;
+    // CRC-32 (see fib_crc32) of both fields
+    uint32_t checksum;
+    uint32_t header_size;
+    uint8_t reserved[24];
+};
+
+struct fib_cache_entry {
+    uint64_t k;
+    // number of bits of the index after the prefix k
+    unsigned shift;
+    size_t ndigits;
+    // (F_{k-1}, F_k), pointing into the mapping
+    void const *fields[2];
+    void *map;
+    size_t map_len;
+};
+
+// whether the cache is on
+int fib_cache_enabled(void);
+// FIB_CACHE_EVERY (0, for the final states only, if unset)
+unsigned fib_cache_every(void);
+
+// maps the entry for the longest binary prefix k = index >> shift of index
+// (with digits of digit_size bytes, and fields of at most max_ndigits digits)
+// returns 0 if there is none
+int fib_cache_find(uint64_t index, size_t digit_size, size_t max_ndigits, struct fib_cache_entry *entry);
+void fib_cache_release(struct fib_cache_entry *entry);
+
+// stores (F_{k-1}, F_k), unless k is already cached
+void fib_cache_store(uint64_t k, size_t digit_size, void const *prev, void const *cur, size_t ndigits);
+// deletes the least recently used entries beyond the size limit (only the
+// first call of each process scans the directory)
+void fib_cache_evict(void);
+
+#endif//FIBCACHE_H
@@ -0,0 +1,179 @@
+#include "fibfile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// CRC-32 (reflected, polynomial 0xedb88320), eight bytes at a time
+static uint32_t crc_table[8][256];
+
+static void crc_init(void)
+{
+    for (uint32_t byte = 0; byte < 256; ++byte)
+    {
+        uint32_t crc = byte;
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = crc >> 1 ^ (crc & 1 ? 0xedb88320u : 0);
+        }
+        crc_table[0][byte] = crc;
+    }
+    for (uint32_t byte = 0; byte < 256; ++byte)
+    {
+        for (int slice = 1; slice < 8; ++slice)
+        {
+            uint32_t const prev = crc_table[slice - 1][byte];
+            crc_table[slice][byte] = prev >> 8 ^ crc_table[0][prev & 0xff];
+        }
+    }
+}
+
+uint32_t fib_crc32(uint32_t crc, void const *const bytes, size_t length)
+{
+    if (!crc_table[0][1])
+    {
+        crc_init();
+    }
+
+    uint8_t const *data = bytes;
+    crc = ~crc;
+    for (; length >= 8; length -= 8, data += 8)
+    {
+        uint32_t const lo = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24);
+        crc = crc_table[7][lo & 0xff] ^ crc_table[6][lo >> 8 & 0xff]
+            ^ crc_table[5][lo >> 16 & 0xff] ^ crc_table[4][lo >> 24]
+            ^ crc_table[3][data[4]] ^ crc_table[2][data[5]]
+            ^ crc_table[1][data[6]] ^ crc_table[0][data[7]];
+    }
+    while (length--)
+    {
+        crc = crc >> 8 ^ crc_table[0][(crc ^ *data++) & 0xff];
+    }
+    return ~crc;
+}
+
+int fib_write_all(int const fd, void const *const bytes, size_t len)
+{
+    char const *text = bytes;
+    while (len)
+    {
+        ssize_t const written = write(fd, text, len);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return 0;
+        }
+        text += written;
+        len -= written;
+    }
+    return 1;
+}
+
+int fib_file_write(int const fd, uint64_t const index, struct number const num)
+{
+    struct fib_header header = {
+        .magic = FIB_MAGIC,
+        .endian = FIB_ENDIAN,
+        .version = FIB_VERSION,
+        .limb_size = FIB_LIMB_SIZE,
+        .index = index,
+        .length = num.length,
+        .checksum = fib_crc32(0, num.bytes, num.length),
+        .header_size = sizeof(struct fib_header),
+    };
+    uint8_t const padding[FIB_LIMB_SIZE] = { 0 };
+    return fib_write_all(fd, &header, sizeof header)
+        && fib_write_all(fd, num.bytes, num.length)
+        && fib_write_all(fd, padding, -num.length % FIB_LIMB_SIZE);
+}
+
+// header written on a machine of the other endianness
+static void swap_header(struct fib_header *const header)
+{
+    header->endian = __builtin_bswap16(header->endian);
+    header->version = __builtin_bswap16(header->version);
+    header->limb_size = __builtin_bswap32(header->limb_size);
+    header->index = __builtin_bswap64(header->index);
+    header->length = __builtin_bswap64(header->length);
+    header->checksum = __builtin_bswap32(header->checksum);
+    header->header_size = __builtin_bswap32(header->header_size);
+}
+
+int fib_file_map(char const *const path, struct fib_file *const file)
+{
+    int const fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st))
+    {
+        fprintf(stderr, "Failed to open file: %s\n", path);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return 0;
+    }
+
+    size_t const map_len = st.st_size;
+    void *const map = map_len >= sizeof(struct fib_header)
+        ? mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0)
+        : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        fprintf(stderr, "Failed to map %s as a Fibonacci container.\n", path);
+        return 0;
+    }
+
+    struct fib_header header;
+    memcpy(&header, map, sizeof header);
+    if (header.endian != FIB_ENDIAN)
+    {
+        swap_header(&header);
+    }
+
+    char const *error = NULL;
+    if (memcmp(header.magic, FIB_MAGIC, sizeof header.magic) || header.endian != FIB_ENDIAN)
+    {
+        error = "not a Fibonacci container";
+    }
+    else if (header.version != FIB_VERSION)
+    {
+        error = "unsupported version";
+    }
+    else if (header.header_size < sizeof header || header.header_size > map_len
+            || header.length > map_len - header.header_size)
+    {
+        error = "truncated";
+    }
+    else
+    {
+        file->index = header.index;
+        file->num.bytes = (uint8_t *)map + header.header_size;
+        file->num.length = header.length;
+        file->map = map;
+        file->map_len = map_len;
+        if (fib_crc32(0, file->num.bytes, file->num.length) != header.checksum)
+        {
+            error = "checksum mismatch";
+        }
+    }
+
+    if (error)
+    {
+        fprintf(stderr, "Failed to read %s: %s.\n", path, error);
+        munmap(map, map_len);
+        return 0;
+    }
+    return 1;
+}
+
+void fib_file_unmap(struct fib_file *const file)
+{
+    munmap(file->map, file->map_len);
+}
@@ -0,0 +1,62 @@
+#ifndef FIBFILE_H
+#define FIBFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fib_base.h"
+
+// Binary container for computed Fibonacci numbers (written by hex.c --bin).
+//
+// A file is a struct fib_header, followed (at offset header_size) by the bytes
+// of the number exactly as in struct number.bytes, i.e. little-endian, zero
+// padded to a whole number of limb_size-byte limbs.
+// The header fields are stored in the byte order of the writer, which readers
+// detect from endian (see check_endian.c); scripts/fibbin.py reads the same
+// format.
+
+#define FIB_MAGIC "FIBSHEAF"
+#define FIB_ENDIAN 0xAABB
+#define FIB_VERSION 1
+#define FIB_LIMB_SIZE 8
+
+struct fib_header {
+    char magic[8];
+    // FIB_ENDIAN, in the byte order of the header
+    uint16_t endian;
+    uint16_t version;
+    uint32_t limb_size;
+    uint64_t index;
+    // bytes of the number (excluding padding)
+    uint64_t length;
+    // CRC-32 (as zlib's crc32) of the length bytes of the number
+    uint32_t checksum;
+    uint32_t header_size;
+    uint8_t reserved[24];
+};
+
+struct fib_file {
+    uint64_t index;
+    // points into the mapping
+    struct number num;
+    void *map;
+    size_t map_len;
+};
+
+// CRC-32 of bytes[0..length), continuing from crc (0 to start)
+uint32_t fib_crc32(uint32_t crc, void const *bytes, size_t length);
+
+// writes len bytes to fd, retrying partial writes
+// returns 0 on failure
+int fib_write_all(int fd, void const *bytes, size_t len);
+
+// writes num (the index-th Fibonacci number) to fd as a container
+// returns 0 on failure
+int fib_file_write(int fd, uint64_t index, struct number num);
+
+// maps the container at path (read-only), and checks its header and checksum
+// returns 0 (after printing why to stderr) if the file cannot be used
+int fib_file_map(char const *path, struct fib_file *file);
+void fib_file_unmap(struct fib_file *file);
+
+#endif//FIBFILE_H
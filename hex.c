@@ -1,66 +1,294 @@
 #include "fib_base.h"
+#include "dec.h"
+#include "fibfile.h"
+#include "verify.h"
+#include "impl/mul/cpu.h"
 
+#include <fcntl.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <time.h>
+#include <unistd.h>
+
+#ifdef __x86_64__
+#   include <immintrin.h>
+#endif
 
 #ifndef CLOCK
 #   define CLOCK CLOCK_PROCESS_CPUTIME_ID
 #endif
 
-int main(int argc, char *argv[])
+// hex characters encoded between two writes
+#ifndef HEX_BUFFER_LEN
+#   define HEX_BUFFER_LEN (1 << 16)
+#endif
+
+static char const hex_digits[] = "0123456789abcdef";
+
+#ifdef __x86_64__
+// encodes the length (a multiple of 32) bytes of bytes[0..length), 32 at a time
+__attribute__((target("avx2")))
+static void encode_hex_avx2(char *restrict text, uint8_t const *restrict const bytes, size_t length)
 {
-    if (argc < 2 || argc > 3)
+    __m256i const digits = _mm256_setr_epi8(
+        '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+        '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    __m256i const reverse = _mm256_setr_epi8(
+        15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+        15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    __m256i const nibble = _mm256_set1_epi8(0x0f);
+    for (; length; length -= 32, text += 64)
     {
-        fprintf(stderr, "Usage: %s index [output.hex]\n", argv[0]);
-        return EXIT_FAILURE;
+        __m256i x = _mm256_loadu_si256((__m256i const *)&bytes[length - 32]);
+        // reverse the bytes of each lane, then swap the lanes
+        x = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(x, reverse), 0x4e);
+        __m256i const hi = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble));
+        __m256i const lo = _mm256_shuffle_epi8(digits, _mm256_and_si256(x, nibble));
+        // bytes 0..7 and 16..23, then bytes 8..15 and 24..31
+        __m256i const even = _mm256_unpacklo_epi8(hi, lo);
+        __m256i const odd = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i *)text, _mm256_permute2x128_si256(even, odd, 0x20));
+        _mm256_storeu_si256((__m256i *)&text[32], _mm256_permute2x128_si256(even, odd, 0x31));
     }
+}
+#endif
 
+// writes the 2 * length hex characters of bytes[0..length) to text,
+// most significant byte first
+static void encode_hex(char *restrict text, uint8_t const *restrict const bytes, size_t length)
+{
+#ifdef __x86_64__
+    if (cpu_tier() >= CPU_AVX2)
+    {
+        // the most significant bytes, in blocks of 32
+        size_t const rest = length % 32;
+        encode_hex_avx2(text, &bytes[rest], length - rest);
+        text += 2 * (length - rest);
+        length = rest;
+    }
+#endif
+    while (length)
+    {
+        uint8_t const byte = bytes[--length];
+        *text++ = hex_digits[byte >> 4];
+        *text++ = hex_digits[byte & 0x0f];
+    }
+}
+
+// streams the hex of bytes[0..length) to fd, HEX_BUFFER_LEN characters at a time
+// returns 0 on failure
+static int write_hex(int const fd, uint8_t const *const bytes, size_t length)
+{
+    char *const buffer = malloc(HEX_BUFFER_LEN);
+    int ok = 1;
+    while (ok && length)
+    {
+        size_t const chunk = length < HEX_BUFFER_LEN / 2 ? length : HEX_BUFFER_LEN / 2;
+        length -= chunk;
+        encode_hex(buffer, &bytes[length], chunk);
+        ok = fib_write_all(fd, buffer, 2 * chunk);
+    }
+    free(buffer);
+    return ok;
+}
+
+// encodes the hex of bytes[0..length) directly into the (regular) file fd
+// returns 0 if the file cannot be mapped
+static int map_hex(int const fd, uint8_t const *const bytes, size_t const length)
+{
+    if (!length || ftruncate(fd, 2 * length))
+    {
+        return 0;
+    }
+    char *const text = mmap(NULL, 2 * length, PROT_WRITE, MAP_SHARED, fd, 0);
+    if (text == MAP_FAILED)
+    {
+        return 0;
+    }
+    encode_hex(text, bytes, length);
+    munmap(text, 2 * length);
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    char *const program = argv[0];
     char *endptr;
-    unsigned long long index = strtoull(argv[1], &endptr, 10);
-    if (*endptr != '\0')
+
+    // --dec[=ndigits]: print in decimal (only the first ndigits + 1 digits, if given)
+    // --bin: write a binary container (see fibfile.h) instead of hex
+    // --read=file: take the number from a container instead of computing it
+    // --verify: check the number modulo a few primes (see verify.h) before writing it
+    int decimal = 0;
+    int binary = 0;
+    int verify = 0;
+    unsigned long long ndigits = 0;
+    char const *input = NULL;
+    for (; argc > 1 && strncmp(argv[1], "--", 2) == 0; ++argv, --argc)
+    {
+        int valid = 1;
+        if (strncmp(argv[1], "--dec", 5) == 0 && (argv[1][5] == '\0' || argv[1][5] == '='))
+        {
+            decimal = 1;
+            if (argv[1][5] == '=')
+            {
+                ndigits = strtoull(&argv[1][6], &endptr, 10);
+                valid = argv[1][6] != '\0' && *endptr == '\0';
+            }
+        }
+        else if (strcmp(argv[1], "--bin") == 0)
+        {
+            binary = 1;
+        }
+        else if (strncmp(argv[1], "--read=", 7) == 0)
+        {
+            input = &argv[1][7];
+        }
+        else if (strcmp(argv[1], "--verify") == 0)
+        {
+            verify = 1;
+        }
+        else
+        {
+            valid = 0;
+        }
+        if (!valid)
+        {
+            fprintf(stderr, "Failed to interpret %s as an option.\n", argv[1]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int const nargs = input ? 1 : 2;
+    if (argc < nargs || argc > nargs + 1 || (decimal && binary))
     {
-        fprintf(stderr, "Failed to interpret %s as an integer.\n", argv[1]);
+        fprintf(stderr,
+            "Usage: %s [--dec[=ndigits] | --bin] [--verify] index [output]\n"
+            "       %s [--dec[=ndigits] | --bin] [--verify] --read=input [output]\n",
+            program, program);
         return EXIT_FAILURE;
     }
+    char const *const output = argc == nargs + 1 ? argv[nargs] : NULL;
 
-    FILE *output_file = argc == 3 ? fopen(argv[2], "w") : stdout;
-    if (output_file == NULL)
+    unsigned long long index = 0;
+    if (!input)
     {
-        fprintf(stderr, "Failed to open file: %s\n", argv[2]);
+        index = strtoull(argv[1], &endptr, 10);
+        if (*endptr != '\0')
+        {
+            fprintf(stderr, "Failed to interpret %s as an integer.\n", argv[1]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int const output_fd = output ? open(output, O_RDWR | O_CREAT | O_TRUNC, 0666) : STDOUT_FILENO;
+    FILE *const output_file = output ? fdopen(output_fd, "w") : stdout;
+    if (output_fd < 0 || output_file == NULL)
+    {
+        fprintf(stderr, "Failed to open file: %s\n", output);
         return EXIT_FAILURE;
     }
 
-    struct timespec start_time;
-    clock_gettime(CLOCK, &start_time);
+    struct number result;
+    struct fib_file file;
+    if (input)
+    {
+        if (!fib_file_map(input, &file))
+        {
+            return EXIT_FAILURE;
+        }
+        index = file.index;
+        result = file.num;
+
+        fprintf(stderr,
+            "# Index:   %llu\n"
+            "# Size:    %llu B\n",
+            index,
+            (long long unsigned)result.length
+        );
+    }
+    else
+    {
+        struct rusage start_usage;
+        getrusage(RUSAGE_SELF, &start_usage);
+        struct timespec start_time;
+        clock_gettime(CLOCK, &start_time);
 
-    struct number result = fibonacci(index);
-    uint8_t *bytes = result.bytes;
-    size_t length = result.length;
+        result = fibonacci(index);
 
-    struct timespec end_time;
-    clock_gettime(CLOCK, &end_time);
+        struct timespec end_time;
+        clock_gettime(CLOCK, &end_time);
+        struct rusage end_usage;
+        getrusage(RUSAGE_SELF, &end_usage);
 
-    fprintf(stderr,
-        "# Runtime: %llu.%09llus\n"
-        "# Size:    %llu B\n",
-        (long long unsigned)(end_time.tv_sec - start_time.tv_sec),
-        (long long unsigned)(end_time.tv_nsec - start_time.tv_nsec),
-        (long long unsigned)length
-    );
+        fprintf(stderr,
+            "# Runtime: %llu.%09llus\n"
+            "# Size:    %llu B\n"
+            "# Faults:  %ld minor, %ld major\n"
+            "# Kernels: %s\n",
+            (long long unsigned)(end_time.tv_sec - start_time.tv_sec),
+            (long long unsigned)(end_time.tv_nsec - start_time.tv_nsec),
+            (long long unsigned)result.length,
+            end_usage.ru_minflt - start_usage.ru_minflt,
+            end_usage.ru_majflt - start_usage.ru_majflt,
+            cpu_tier_names[cpu_tier()]
+        );
+    }
 
-    do
+    if (verify)
     {
-        fprintf(output_file, "%02x", bytes[--length]);
+        struct timespec start_time;
+        clock_gettime(CLOCK, &start_time);
+        int const verified = verify_fibonacci(index, result);
+        struct timespec end_time;
+        clock_gettime(CLOCK, &end_time);
+
+        double const seconds = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) * 1e-9;
+        fprintf(stderr, "# Verify:  %s (%.9fs)\n", verified ? "passed" : "FAILED", seconds);
+        if (!verified)
+        {
+            fprintf(stderr, "The number is not F(%llu).\n", index);
+            return EXIT_FAILURE;
+        }
     }
-    while (length);
 
-    free(bytes);
+    uint8_t const *const bytes = result.bytes;
+    size_t const length = result.length;
 
-    if (argc == 3)
+    int written = 1;
+    if (decimal)
     {
-        fclose(output_file);
+        fprint_dec(output_file, result, ndigits);
+    }
+    else if (binary)
+    {
+        written = fib_file_write(output_fd, index, result);
+    }
+    else if (!(output && map_hex(output_fd, bytes, length)))
+    {
+        written = write_hex(output_fd, bytes, length);
+    }
+    if (!written)
+    {
+        fprintf(stderr, "Failed to write output.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (input)
+    {
+        fib_file_unmap(&file);
     }
     else
+    {
+        free(result.bytes);
+    }
+
+    if (output)
+    {
+        fclose(output_file);
+    }
+    else if (!binary)
     {
         putc('\n', stdout);
     }
@@ -0,0 +1,216 @@
+#include "fib_base.h"
+
+#if defined(DEBUG) || defined(ONLY64)
+#   define DIGIT uint32_t
+#   define DBDGT uint64_t
+#else
+#   define DIGIT uint64_t
+#   define DBDGT __uint128_t
+#endif
+
+#define DIGIT_BIT (CHAR_BIT * sizeof(DIGIT))
+#define DBDGT_BIT (CHAR_BIT * sizeof(DBDGT))
+
+#include "mul/mul.h"
+
+static size_t ndigit_estimate(uint64_t const index)
+{
+    // Each buffer must fit a (non-normalised) product of F_k and 2F_{k+1} - F_k
+    // (= L_k), with 2k <= index, as well as a couple of carry digits; since F_k
+    // and L_k have at most k log2(phi) + 1 bits, fib_bits(index) / D + 5 digits
+    // are enough.
+    return fib_bits(index) / DIGIT_BIT + 5;
+}
+
+// computes 2 * (*a) - (*b) in place, where (*b) has bdigits <= adigits digits
+// (the caller guarantees that the result is nonnegative)
+// returns the number of digits in the result
+static size_t double_sub(
+        DIGIT *restrict a, DIGIT const *restrict b,
+        size_t const adigits, size_t const bdigits)
+{
+    DIGIT spill = 0;
+    unsigned borrow = 0;
+    for (size_t offset = 0; offset < adigits; ++offset)
+    {
+        DIGIT const digit = a[offset];
+        DIGIT const twice = (digit << 1) | spill;
+        spill = digit >> (DIGIT_BIT - 1);
+
+        DIGIT diff;
+        unsigned const b1 = __builtin_sub_overflow(twice, offset < bdigits ? b[offset] : 0, &diff);
+        unsigned const b2 = __builtin_sub_overflow(diff, (DIGIT)borrow, &a[offset]);
+        borrow = b1 | b2;
+    }
+    a[adigits] = spill - borrow;
+    return normalised_len(a, adigits + 1);
+}
+
+// computes ((*p) + 5 (*q)) / 2 + (-1)^parity in place (in q), where (*p) has
+// pdigits digits and (*q) has qdigits <= pdigits digits
+// returns the number of digits in the result
+static size_t halve_accum(
+        DIGIT *const q, DIGIT const *const p,
+        size_t const pdigits, size_t const qdigits, unsigned const parity)
+{
+    // q = p + 5q
+    DBDGT carry = 0;
+    for (size_t offset = 0; offset < pdigits; ++offset)
+    {
+        DBDGT const acc
+            = ((DBDGT)p[offset])
+            + (offset < qdigits ? ((DBDGT)q[offset]) * 5 : 0)
+            + carry;
+        q[offset] = (DIGIT)acc;
+        carry = acc >> DIGIT_BIT;
+    }
+    q[pdigits] = (DIGIT)carry;
+
+    // q /= 2 (exact)
+    for (size_t offset = 0; offset < pdigits; ++offset)
+    {
+        q[offset] = (q[offset] >> 1) | (q[offset + 1] << (DIGIT_BIT - 1));
+    }
+    q[pdigits] >>= 1;
+
+    // q += (-1)^parity
+    if (parity)
+    {
+        DIGIT *digit = q;
+        while (!(*digit)--)
+        {
+            ++digit;
+        }
+    }
+    else
+    {
+        add_carry(q, 1);
+    }
+    return normalised_len(q, pdigits + 1);
+}
+
+// [ f, d ] -> [ f d, f^2 ], pointwise
+static void multiply_pointwise(
+        uint64_t *restrict x, uint64_t *restrict y,
+        size_t const begin, size_t const end, struct ntt_prime const *const prime)
+{
+    for (size_t i = begin; i < end; ++i)
+    {
+        y[i] = ntt_mulmod(x[i], y[i], prime);
+        x[i] = ntt_mulmod(x[i], x[i], prime);
+    }
+}
+
+// computes (*f) * (*d) and (*f)^2 with number-theoretic transforms, and writes
+// the results to p (fdigits + ddigits digits) and q (2*fdigits digits)
+// (*f) is only transformed once, so that both products cost two forward and
+// two inverse transforms (run prime by prime in the scratch of ntt, see ntt_pair)
+// a step of fastsquaring.c costs as much past NTT_THRESHOLD, so that the two
+// only differ below it (see the README)
+static void multiply_ntt(
+        DIGIT *restrict p, DIGIT *restrict q,
+        DIGIT const *const f, DIGIT const *const d,
+        size_t const fdigits, size_t const ddigits,
+        struct ntt *const ntt)
+{
+    ntt_reserve(ntt, ntt_size(fdigits + ddigits - 1), 3 * fdigits + ddigits);
+    ntt_pair(ntt, q, 2 * fdigits, p, fdigits + ddigits, f, fdigits, d, ddigits, multiply_pointwise);
+}
+
+// as the name suggests
+static void swap(DIGIT **lhs, DIGIT **rhs)
+{
+    DIGIT *tmp = *lhs;
+    *lhs = *rhs;
+    *rhs = tmp;
+}
+
+// return only the most significant set bit of x
+static uint64_t msb(uint64_t const x)
+{
+    // __builtin_clzll(0) is undefined
+    return 1llu << (63 - __builtin_clzll(x|1));
+}
+
+struct number fibonacci(uint64_t index)
+{
+    size_t const ndigits_max = ndigit_estimate(index);
+    log("Allocating %llu bytes per field.\n",
+            (long long unsigned)(ndigits_max * sizeof(DIGIT)));
+
+    uint64_t mask = msb(index);
+
+    struct number result;
+    size_t const block_bytes = 4 * ndigits_max * sizeof(DIGIT);
+    DIGIT *const block = alloc_zeroed(block_bytes);
+
+    // (f, g) = (F_k, F_{k+1}), and (p, q) hold the products
+    DIGIT *f = block;
+    DIGIT *g = &f[ndigits_max];
+    DIGIT *p = &g[ndigits_max];
+    DIGIT *q = &p[ndigits_max];
+
+    // (scratch is only needed below NTT_THRESHOLD)
+    DIGIT *const scratch = malloc(mul_scratch_len(ndigits_max < NTT_THRESHOLD ? ndigits_max : NTT_THRESHOLD) * sizeof(DIGIT));
+    // twiddle factors and scratch of the transforms, set up once for the
+    // longest products (which fit in a field)
+    struct ntt ntt = { 0 };
+    if (ndigits_max >= 2 * NTT_THRESHOLD)
+    {
+        ntt_reserve(&ntt, ntt_size(ndigits_max - 1), 2 * ndigits_max);
+    }
+
+    size_t f_len = 1;
+    size_t g_len = 1;
+    unsigned parity = 0;
+
+    // (F_0, F_1)
+    *f = 0;
+    *g = 1;
+
+    for (; mask; mask >>= 1)
+    {
+        // F_{2k}   = F_k (2F_{k+1} - F_k)
+        // F_{2k+1} = F_k^2 + F_{k+1}^2 = (F_{2k} + 5F_k^2) / 2 + (-1)^k
+        // (the latter by Cassini's identity F_{k+1}^2 - F_kF_{k+1} - F_k^2 = (-1)^k)
+        size_t const d_len = double_sub(g, f, g_len, f_len);
+        size_t const p_len = f_len + d_len;
+        if (f_len < NTT_THRESHOLD)
+        {
+            mul(p, f, f_len, g, d_len, scratch);
+            sqr_n(q, f, f_len, scratch);
+        }
+        else
+        {
+            multiply_ntt(p, q, f, g, f_len, d_len, &ntt);
+        }
+        size_t const q_len = halve_accum(q, p, p_len, 2 * f_len, parity);
+        f_len = normalised_len(p, p_len);
+        g_len = q_len;
+        parity = 0;
+
+        if (index & mask)
+        {
+            // (F_{2k+1}, F_{2k+2}) = (q, p + q)
+            memset(&p[f_len], 0, (q_len + 1 - f_len) * sizeof(DIGIT));
+            add_accum(p, q, q_len);
+            g_len = normalised_len(p, q_len + 1);
+            f_len = q_len;
+            swap(&p, &q);
+            parity = 1;
+        }
+        log("f_len: %llu\n", (long long unsigned)f_len);
+
+        swap(&f, &p);
+        swap(&g, &q);
+    }
+
+    free(scratch);
+    ntt_free(&ntt);
+
+    result.length = f_len * sizeof(DIGIT);
+    memmove(block, f, result.length);
+    // give back the other buffers
+    result.bytes = alloc_keep(block, block_bytes, result.length);
+    return result;
+}
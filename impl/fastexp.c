@@ -13,21 +13,21 @@
 
 #define TUPLE_LEN 3
 
-// crude estimate
+#include "mul/mul.h"
+#include "mul/arena.h"
+
 static size_t ndigit_estimate(uint64_t const index)
 {
-    // Given the current implementation, each "chunk" needs enough digits
-    // to fit the product of F_index and F_{index+1}.
-    // Since (coarsely) F_n < 2^(n-1) [for n > 1], this means that
-    // a coarse upper bound for the product is 2^(2n-1).
-    // Therefore, the number of digits is ceil((2n-1)/D).
-    // We'll approximate this with 2n/D + 2
-    // ... plus 2 more for the edge cases at the beginning
-    return (2*index + DIGIT_BIT - 1) / DIGIT_BIT + 2;
+    // The entries of fib and accum are (at most) F_{k+1} for exponents k adding
+    // up to at most index (accum is not squared past the last bit of index).
+    // Since F_{k+1} has at most k log2(phi) + 1 bits, each field (and each
+    // product of a field of fib and one of accum, plus the carry digit that the
+    // basecase kernels write past it) fits in fib_bits(index) / D + 5 digits.
+    return fib_bits(index) / DIGIT_BIT + 5;
 }
 
 // computes (*a) * scale and accumulates the result in accum1 and accum2
-// returns the max length of accum1 or accum2
+// (the carry lands in the two digits past ndigits of each)
 static void scale_accum_once(
         DIGIT *restrict accum1, DIGIT *restrict accum2,
         DIGIT const *const a, DBDGT const scale, size_t const ndigits)
@@ -40,28 +40,8 @@ static void scale_accum_once(
     debugmem(&scale, sizeof(DBDGT));
     debug(" = ");
 
-    DBDGT carry1 = 0;
-    DBDGT carry2 = 0;
-    for (size_t offset = 0; offset < ndigits; ++offset)
-    {
-        DBDGT const prod = ((DBDGT)a[offset]) * scale;
-
-        DBDGT const acc1
-            = ((DBDGT)accum1[offset])
-            + prod
-            + carry1;
-        accum1[offset] = (DIGIT)acc1;
-        carry1 = acc1 >> DIGIT_BIT;
-
-        DBDGT const acc2
-            = ((DBDGT)accum2[offset])
-            + prod
-            + carry2;
-        accum2[offset] = (DIGIT)acc2;
-        carry2 = acc2 >> DIGIT_BIT;
-    }
-    *(DBDGT *)&accum1[ndigits] += carry1;
-    *(DBDGT *)&accum2[ndigits] += carry2;
+    *(digit_pair *)&accum1[ndigits] += addmul_1(accum1, a, ndigits, (DIGIT)scale);
+    *(digit_pair *)&accum2[ndigits] += addmul_1(accum2, a, ndigits, (DIGIT)scale);
 
     debugmem(accum1, (ndigits + 2) * sizeof(DIGIT));
     debug("\n");
@@ -72,28 +52,9 @@ static void scale_accum_twice(
         DIGIT *restrict accum1, DIGIT *restrict accum2,
         DIGIT const *const a, DBDGT const scale1, DBDGT const scale2, size_t const ndigits)
 {
-    DBDGT carry1 = 0;
-    DBDGT carry2 = 0;
-    for (size_t offset = 0; offset < ndigits; ++offset)
-    {
-        DBDGT const adig = a[offset];
-
-        DBDGT const acc1
-            = ((DBDGT)accum1[offset])
-            + adig * scale1
-            + carry1;
-        accum1[offset] = (DIGIT)acc1;
-        carry1 = acc1 >> DIGIT_BIT;
-
-        DBDGT const acc2
-            = ((DBDGT)accum2[offset])
-            + adig * scale2
-            + carry2;
-        accum2[offset] = (DIGIT)acc2;
-        carry2 = acc2 >> DIGIT_BIT;
-    }
-    *(DBDGT *)&accum1[ndigits] += carry1;
-    *(DBDGT *)&accum2[ndigits] += carry2;
+    // two rows of addmul_1 (each of which already interleaves two carry chains)
+    *(digit_pair *)&accum1[ndigits] += addmul_1(accum1, a, ndigits, (DIGIT)scale1);
+    *(digit_pair *)&accum2[ndigits] += addmul_1(accum2, a, ndigits, (DIGIT)scale2);
 }
 
 // compute (*a) * (*b), and accumulate the result in accum1 and accum2
@@ -119,23 +80,166 @@ static size_t multiply_twice(
     {
         scale_accum_twice(&accum1[offset], &accum2[offset], a, b1[offset], b2[offset], adigits);
     }
-    for (size_t len = adigits + bdigits;; --len)
+    for (size_t len = adigits + bdigits; len; --len)
     {
         if (accum1[len] || accum2[len])
         {
             return len + 1;
         }
     }
+    return 1;
+}
+
+// computes (a, b, c) * (a', b', c') with the multiplication engine, and
+// accumulates the results in (accum1, accum2, accum3)
+// (a, b, c) has ndigits1 digits, and (a', b', c') has ndigits2 digits
+// prod is scratch space for ndigits1 + ndigits2 digits, and scratch holds
+// mul_scratch_len(max(ndigits1, ndigits2)) digits
+// returns the max number of digits in accum2 and accum3
+static size_t multiply_fast(
+        DIGIT *restrict accum1, DIGIT *restrict accum2, DIGIT *restrict accum3,
+        DIGIT const *const a1, DIGIT const *const b1, DIGIT const *const c1,
+        DIGIT const *const a2, DIGIT const *const b2, DIGIT const *const c2,
+        size_t const ndigits1, size_t const ndigits2,
+        DIGIT *restrict prod, DIGIT *restrict scratch)
+{
+    size_t const plen = ndigits1 + ndigits2;
+
+    // +[aa', ab',   0]
+    // +[bb',   0, bb']
+    // +[  0, c'b, c'c]
+    mul(prod, a1, ndigits1, a2, ndigits2, scratch);
+    add_accum(accum1, prod, plen);
+    mul(prod, a1, ndigits1, b2, ndigits2, scratch);
+    add_accum(accum2, prod, plen);
+    mul(prod, b1, ndigits1, b2, ndigits2, scratch);
+    add_accum(accum1, prod, plen);
+    add_accum(accum3, prod, plen);
+    mul(prod, b1, ndigits1, c2, ndigits2, scratch);
+    add_accum(accum2, prod, plen);
+    mul(prod, c1, ndigits1, c2, ndigits2, scratch);
+    add_accum(accum3, prod, plen);
+
+    for (size_t len = plen;; --len)
+    {
+        if (accum2[len] || accum3[len])
+        {
+            return len + 1;
+        }
+    }
 }
 
-// swap the addresses pointed to by *lhs and *rhs
-static void swap(DIGIT **lhs, DIGIT **rhs)
+#ifdef FIB_THREADS
+// state shared by the tasks of a threaded multiplication step
+struct multiply_job {
+    DIGIT *accum[3];
+    DIGIT const *x[3];
+    DIGIT const *y[3];
+    size_t ndigits1;
+    size_t ndigits2;
+    size_t nbands;
+    // carries out of each band
+    DIGIT *carries;
+
+    // products (ndigits1 + ndigits2 digits each) and scratch for the engine
+    DIGIT *prods[5];
+    DIGIT *scratch[5];
+};
+
+// aa', ab', bb', bc' and cc', one per task
+static void multiply_products_task(void *arg, size_t const index)
 {
-    DIGIT *tmp = *lhs;
-    *lhs = *rhs;
-    *rhs = tmp;
+    static unsigned char const lhs[5] = { 0, 0, 1, 1, 2 };
+    static unsigned char const rhs[5] = { 0, 1, 1, 2, 2 };
+
+    struct multiply_job *const job = arg;
+    mul(job->prods[index],
+            job->x[lhs[index]], job->ndigits1,
+            job->y[rhs[index]], job->ndigits2,
+            job->scratch[index]);
 }
 
+// +[aa' + bb', ab' + bc', bb' + cc'] over a band of digits
+static void multiply_bands_task(void *arg, size_t const index)
+{
+    static unsigned char const first[3] = { 0, 1, 2 };
+    static unsigned char const second[3] = { 2, 3, 4 };
+
+    struct multiply_job *const job = arg;
+    size_t const plen = job->ndigits1 + job->ndigits2;
+    size_t const begin = band_begin(plen, job->nbands, index);
+    size_t const end = band_begin(plen, job->nbands, index + 1);
+
+    for (unsigned k = 0; k < 3; ++k)
+    {
+        DIGIT *const accum = job->accum[k];
+        DIGIT const *const p1 = job->prods[first[k]];
+        DIGIT const *const p2 = job->prods[second[k]];
+
+        DBDGT carry = 0;
+        for (size_t offset = begin; offset < end; ++offset)
+        {
+            DBDGT const acc
+                = ((DBDGT)accum[offset])
+                + p1[offset]
+                + p2[offset]
+                + carry;
+            accum[offset] = (DIGIT)acc;
+            carry = acc >> DIGIT_BIT;
+        }
+        job->carries[3 * index + k] = (DIGIT)carry;
+    }
+}
+
+// multiply_fast, with the five products (and then the sums) spread over the pool
+// prods must fit 5 * (ndigits1 + ndigits2) digits, and scratch 5 * scratch_len digits
+static size_t multiply_fast_threaded(
+        DIGIT *restrict accum1, DIGIT *restrict accum2, DIGIT *restrict accum3,
+        DIGIT const *const a1, DIGIT const *const b1, DIGIT const *const c1,
+        DIGIT const *const a2, DIGIT const *const b2, DIGIT const *const c2,
+        size_t const ndigits1, size_t const ndigits2,
+        DIGIT *restrict prods, DIGIT *restrict scratch, size_t const scratch_len,
+        struct pool *const pool)
+{
+    size_t const plen = ndigits1 + ndigits2;
+    struct multiply_job job = {
+        .accum = { accum1, accum2, accum3 },
+        .x = { a1, b1, c1 },
+        .y = { a2, b2, c2 },
+        .ndigits1 = ndigits1, .ndigits2 = ndigits2,
+        .nbands = pool->nthreads,
+    };
+    for (unsigned i = 0; i < 5; ++i)
+    {
+        job.prods[i] = &prods[i * plen];
+        job.scratch[i] = &scratch[i * scratch_len];
+    }
+    job.carries = malloc(3 * job.nbands * sizeof(DIGIT));
+
+    pool_run(pool, multiply_products_task, &job, 5);
+    pool_run(pool, multiply_bands_task, &job, job.nbands);
+
+    // propagate the carries out of the bands, in order
+    for (size_t i = 0; i < job.nbands; ++i)
+    {
+        size_t const end = band_begin(plen, job.nbands, i + 1);
+        for (unsigned k = 0; k < 3; ++k)
+        {
+            add_carry(&job.accum[k][end], job.carries[3 * i + k]);
+        }
+    }
+    free(job.carries);
+
+    for (size_t len = plen;; --len)
+    {
+        if (accum2[len] || accum3[len])
+        {
+            return len + 1;
+        }
+    }
+}
+#endif
+
 struct number fibonacci(uint64_t index)
 {
     size_t const ndigits_max = ndigit_estimate(index);
@@ -143,20 +247,46 @@ struct number fibonacci(uint64_t index)
             (long long unsigned)(ndigits_max * sizeof(DIGIT)));
 
     struct number result;
-    result.bytes = calloc(3 * TUPLE_LEN * ndigits_max, sizeof(DIGIT));
+    size_t const block_bytes = 3 * TUPLE_LEN * ndigits_max * sizeof(DIGIT);
+
+    // product and scratch space for the multiplication engine
+    // (products fit in a field, and scratch is only needed below NTT_THRESHOLD)
+    size_t const scratch_len = mul_scratch_len(ndigits_max < NTT_THRESHOLD ? ndigits_max : NTT_THRESHOLD);
+    size_t const prod_bytes = (ndigits_max + scratch_len) * sizeof(DIGIT);
+
+#   ifdef FIB_THREADS
+    // the pool comes first, for the big blocks to be allocated on it
+    struct pool pool;
+    pool_init(&pool, FIB_THREADS);
+    DIGIT *const block = alloc_zeroed_on(&pool, block_bytes);
+    DIGIT *const prod = alloc_zeroed_on(&pool, prod_bytes);
+
+    // one product and one scratch buffer per task
+    size_t const thread_scratch_len = scratch_len;
+    size_t const thread_bytes = 5 * (ndigits_max + thread_scratch_len) * sizeof(DIGIT);
+    DIGIT *const thread_prods = alloc_zeroed_on(&pool, thread_bytes);
+    DIGIT *const thread_scratch = &thread_prods[5 * ndigits_max];
+#   else
+    DIGIT *const block = alloc_zeroed(block_bytes);
+    DIGIT *const prod = alloc_zeroed(prod_bytes);
+#   endif
+    DIGIT *const mul_scratch = &prod[ndigits_max];
 
-#   define A(ptr) &(ptr)[0]
-#   define B(ptr) &(ptr)[ndigits_max]
-#   define C(ptr) &(ptr)[2*ndigits_max]
+#   define A(buf) &(buf).digits[0]
+#   define B(buf) &(buf).digits[ndigits_max]
+#   define C(buf) &(buf).digits[2*ndigits_max]
 
-    DIGIT *fib = result.bytes;
-    DIGIT *accum = &fib[TUPLE_LEN * ndigits_max];
-    DIGIT *scratch = &fib[2 * TUPLE_LEN * ndigits_max];
+    struct arena const arena = { .nfields = TUPLE_LEN, .stride = ndigits_max };
+    struct arena_buf fib = arena_at(&arena, block, 0);
+    struct arena_buf accum = arena_at(&arena, block, 1);
+    struct arena_buf scratch = arena_at(&arena, block, 2);
 
     size_t fib_len = 1;
     size_t accum_len = 1;
 
     // init fib to identity
+    arena_clear(&arena, &fib, 1);
+    arena_clear(&arena, &accum, 1);
     *A(fib) = 1;
     *B(fib) = 0;
     *C(fib) = 1;
@@ -172,31 +302,123 @@ struct number fibonacci(uint64_t index)
         if (index & 1)
         {
             // fib *= accum
-            memset(scratch, 0, TUPLE_LEN * ndigits_max * sizeof(DIGIT));
+            // (the products, and the carry digit past them, fit in fib_len + accum_len + 1 digits)
+            arena_clear(&arena, &scratch, fib_len + accum_len + 1);
 
+            if (fib_len < KARATSUBA_THRESHOLD || accum_len < KARATSUBA_THRESHOLD)
+            {
+                // +[aa', ab',   0]
+                // +[bb',   0, bb']
+                // +[  0, c'b, c'c]
+                multiply_twice(A(scratch), B(scratch), A(fib), A(accum), B(accum), fib_len, accum_len);
+                multiply_once(A(scratch), C(scratch), B(fib), B(accum), fib_len, accum_len);
+                fib_len = multiply_twice(B(scratch), C(scratch), C(accum), B(fib), C(fib), accum_len, fib_len);
+            }
+#           ifdef FIB_THREADS
+            else if (fib_len >= FIB_THREADS_THRESHOLD || accum_len >= FIB_THREADS_THRESHOLD)
+            {
+                fib_len = multiply_fast_threaded(
+                        A(scratch), B(scratch), C(scratch),
+                        A(fib), B(fib), C(fib),
+                        A(accum), B(accum), C(accum),
+                        fib_len, accum_len,
+                        thread_prods, thread_scratch, thread_scratch_len, &pool);
+            }
+#           endif
+            else
+            {
+                fib_len = multiply_fast(
+                        A(scratch), B(scratch), C(scratch),
+                        A(fib), B(fib), C(fib),
+                        A(accum), B(accum), C(accum),
+                        fib_len, accum_len, prod, mul_scratch);
+            }
+            arena_swap(&fib, &scratch);
+        }
+        if (index == 1)
+        {
+            // accum is no longer needed
+            break;
+        }
+
+        // accum *= accum
+        arena_clear(&arena, &scratch, 2 * accum_len + 1);
+
+        if (accum_len < KARATSUBA_THRESHOLD)
+        {
             // +[aa', ab',   0]
             // +[bb',   0, bb']
             // +[  0, c'b, c'c]
-            multiply_twice(A(scratch), B(scratch), A(fib), A(accum), B(accum), fib_len, accum_len);
-            multiply_once(A(scratch), C(scratch), B(fib), B(accum), fib_len, accum_len);
-            fib_len = multiply_twice(B(scratch), C(scratch), C(accum), B(fib), C(fib), accum_len, fib_len);
-            swap(&fib, &scratch);
+            multiply_twice(A(scratch), B(scratch), A(accum), A(accum), B(accum), accum_len, accum_len);
+            multiply_once(A(scratch), C(scratch), B(accum), B(accum), accum_len, accum_len);
+            accum_len = multiply_twice(B(scratch), C(scratch), C(accum), B(accum), C(accum), accum_len, accum_len);
         }
-
-        // accum *= accum
-        memset(scratch, 0, TUPLE_LEN * ndigits_max * sizeof(DIGIT));
-
-        // +[aa', ab',   0]
-        // +[bb',   0, bb']
-        // +[  0, c'b, c'c]
-        multiply_twice(A(scratch), B(scratch), A(accum), A(accum), B(accum), accum_len, accum_len);
-        multiply_once(A(scratch), C(scratch), B(accum), B(accum), accum_len, accum_len);
-        accum_len = multiply_twice(B(scratch), C(scratch), C(accum), B(accum), C(accum), accum_len, accum_len);
-        swap(&accum, &scratch);
+#       ifdef FIB_THREADS
+        else if (accum_len >= FIB_THREADS_THRESHOLD)
+        {
+            accum_len = multiply_fast_threaded(
+                    A(scratch), B(scratch), C(scratch),
+                    A(accum), B(accum), C(accum),
+                    A(accum), B(accum), C(accum),
+                    accum_len, accum_len,
+                    thread_prods, thread_scratch, thread_scratch_len, &pool);
+        }
+#       endif
+        else
+        {
+            // (the engine detects the squares aa, bb and cc)
+            accum_len = multiply_fast(
+                    A(scratch), B(scratch), C(scratch),
+                    A(accum), B(accum), C(accum),
+                    A(accum), B(accum), C(accum),
+                    accum_len, accum_len, prod, mul_scratch);
+        }
+        arena_swap(&accum, &scratch);
     }
 
+    alloc_free(prod, prod_bytes);
+#   ifdef FIB_THREADS
+    alloc_free(thread_prods, thread_bytes);
+    pool_free(&pool);
+#   endif
+
     result.length = fib_len * sizeof(DIGIT);
-    memcpy(result.bytes, B(fib), result.length);
+    memcpy(block, B(fib), result.length);
+    // give back the other fields
+    result.bytes = alloc_keep(block, block_bytes, result.length);
     return result;
 }
 
+
+#ifdef MICRO_KERNELS
+#include "micro.h"
+
+static void micro_scale_accum_once(void *accum1, void *accum2, void const *a, void const *b, size_t const n)
+{
+    scale_accum_once(accum1, accum2, a, *(DIGIT const *)b, n);
+}
+
+static void micro_scale_accum_twice(void *accum1, void *accum2, void const *a, void const *b, size_t const n)
+{
+    DIGIT const *const scales = b;
+    scale_accum_twice(accum1, accum2, a, scales[0], scales[1], n);
+}
+
+static void micro_multiply_once(void *accum1, void *accum2, void const *a, void const *b, size_t const n)
+{
+    multiply_once(accum1, accum2, a, b, n, n);
+}
+
+static void micro_multiply_twice(void *accum1, void *accum2, void const *a, void const *b, size_t const n)
+{
+    multiply_twice(accum1, accum2, a, b, a, n, n);
+}
+
+struct micro_kernel const micro_kernels[] = {
+    { "scale_accum_once", sizeof(DIGIT), 0, micro_scale_accum_once },
+    { "scale_accum_twice", sizeof(DIGIT), 0, micro_scale_accum_twice },
+    { "multiply_once", sizeof(DIGIT), 1, micro_multiply_once },
+    { "multiply_twice", sizeof(DIGIT), 1, micro_multiply_twice },
+};
+size_t const micro_nkernels = sizeof(micro_kernels) / sizeof(*micro_kernels);
+#endif//MICRO_KERNELS
@@ -13,10 +13,16 @@
 
 #define TUPLE_LEN 2
 
-// crude estimate
+#include "mul/mul.h"
+#include "mul/arena.h"
+
 static size_t ndigit_estimate(uint64_t const index)
 {
-    return (2*index + DIGIT_BIT - 1) / DIGIT_BIT + 2;
+    // The entries of fib and accum are (at most) F_k for exponents k adding up
+    // to at most index (accum is not squared past the last bit of index), so
+    // each field, and each product of a field of fib and one of accum (plus a
+    // carry digit), fits in fib_bits(index) / D + 5 digits.
+    return fib_bits(index) / DIGIT_BIT + 5;
 }
 
 // (*accum) = (*a) * scale
@@ -24,18 +30,7 @@ static void scale_accum(
         DIGIT *restrict accum,
         DIGIT const *const a, DBDGT const scale, size_t const ndigits)
 {
-    DBDGT carry = 0;
-    for (size_t offset = 0; offset < ndigits; ++offset)
-    {
-        DBDGT const adig = a[offset];
-        DBDGT const acc
-            = ((DBDGT)accum[offset])
-            + adig * scale
-            + carry;
-        accum[offset] = (DIGIT)acc;
-        carry = acc >> DIGIT_BIT;
-    }
-    *(DBDGT *)&accum[ndigits] += carry;
+    *(digit_pair *)&accum[ndigits] += addmul_1(accum, a, ndigits, (DIGIT)scale);
 }
 
 // computes (*a) * (scale1, scale2) and accumulates the results in (accum1, accum2)
@@ -43,28 +38,9 @@ static void scale_accum_twice(
         DIGIT *restrict accum1, DIGIT *restrict accum2,
         DIGIT const *const a, DBDGT const scale1, DBDGT const scale2, size_t const ndigits)
 {
-    DBDGT carry1 = 0;
-    DBDGT carry2 = 0;
-    for (size_t offset = 0; offset < ndigits; ++offset)
-    {
-        DBDGT const adig = a[offset];
-
-        DBDGT const acc1
-            = ((DBDGT)accum1[offset])
-            + adig * scale1
-            + carry1;
-        accum1[offset] = (DIGIT)acc1;
-        carry1 = acc1 >> DIGIT_BIT;
-
-        DBDGT const acc2
-            = ((DBDGT)accum2[offset])
-            + adig * scale2
-            + carry2;
-        accum2[offset] = (DIGIT)acc2;
-        carry2 = acc2 >> DIGIT_BIT;
-    }
-    *(DBDGT *)&accum1[ndigits] += carry1;
-    *(DBDGT *)&accum2[ndigits] += carry2;
+    // two rows of addmul_1 (each of which already interleaves two carry chains)
+    *(digit_pair *)&accum1[ndigits] += addmul_1(accum1, a, ndigits, (DIGIT)scale1);
+    *(digit_pair *)&accum2[ndigits] += addmul_1(accum2, a, ndigits, (DIGIT)scale2);
 }
 
 // computes (*a) * scale and accumulates the result in accum1 and accum2
@@ -72,28 +48,8 @@ static void scale_accum_dup(
         DIGIT *restrict accum1, DIGIT *restrict accum2,
         DIGIT const *const a, DBDGT const scale, size_t const ndigits)
 {
-    DBDGT carry1 = 0;
-    DBDGT carry2 = 0;
-    for (size_t offset = 0; offset < ndigits; ++offset)
-    {
-        DBDGT const prod = ((DBDGT)a[offset]) * scale;
-
-        DBDGT const acc1
-            = ((DBDGT)accum1[offset])
-            + prod
-            + carry1;
-        accum1[offset] = (DIGIT)acc1;
-        carry1 = acc1 >> DIGIT_BIT;
-
-        DBDGT const acc2
-            = ((DBDGT)accum2[offset])
-            + prod
-            + carry2;
-        accum2[offset] = (DIGIT)acc2;
-        carry2 = acc2 >> DIGIT_BIT;
-    }
-    *(DBDGT *)&accum1[ndigits] += carry1;
-    *(DBDGT *)&accum2[ndigits] += carry2;
+    *(digit_pair *)&accum1[ndigits] += addmul_1(accum1, a, ndigits, (DIGIT)scale);
+    *(digit_pair *)&accum2[ndigits] += addmul_1(accum2, a, ndigits, (DIGIT)scale);
 }
 
 // computes a * b
@@ -140,12 +96,47 @@ static void multiply_dup(
     }
 }
 
-// as the name suggests
-static void swap(DIGIT **lhs, DIGIT **rhs)
+// computes (a1, b1) x (a2, b2) with the subquadratic multiplication engine,
+// and accumulates the result in (accum1, accum2)
+// prod must fit len1 + len2 digits, and scratch mul_scratch_len(max(len1, len2)) digits
+// returns the number of digits in accum2
+static size_t multiply_fast(
+        DIGIT *restrict accum1, DIGIT *restrict accum2,
+        DIGIT const *const a1, DIGIT const *const b1,
+        DIGIT const *const a2, DIGIT const *const b2,
+        size_t const len1, size_t const len2,
+        DIGIT *restrict prod, DIGIT *restrict scratch)
 {
-    DIGIT *tmp = *lhs;
-    *lhs = *rhs;
-    *rhs = tmp;
+    size_t const plen = len1 + len2;
+
+    // +[ a1a2,    0 ]
+    mul(prod, a1, len1, a2, len2, scratch);
+    add_accum(accum1, prod, normalised_len(prod, plen));
+
+    // +[ b1b2, b1b2 ]
+    mul(prod, b1, len1, b2, len2, scratch);
+    add_accum(accum1, prod, normalised_len(prod, plen));
+    add_accum(accum2, prod, normalised_len(prod, plen));
+
+    // +[    0, a1b2 ]
+    mul(prod, a1, len1, b2, len2, scratch);
+    add_accum(accum2, prod, normalised_len(prod, plen));
+
+    // +[    0, b1a2 ]
+    // (when squaring, this is a1b2 again)
+    if (a1 != a2 || b1 != b2)
+    {
+        mul(prod, b1, len1, a2, len2, scratch);
+    }
+    add_accum(accum2, prod, normalised_len(prod, plen));
+
+    for (size_t len = plen;; --len)
+    {
+        if (accum2[len])
+        {
+            return len + 1;
+        }
+    }
 }
 
 struct number fibonacci(uint64_t index)
@@ -153,19 +144,29 @@ struct number fibonacci(uint64_t index)
     size_t ndigits_max = ndigit_estimate(index);
 
     struct number result;
-    result.bytes = calloc(3 * TUPLE_LEN * ndigits_max, sizeof(DIGIT));
+    size_t const block_bytes = 3 * TUPLE_LEN * ndigits_max * sizeof(DIGIT);
+    DIGIT *const block = alloc_zeroed(block_bytes);
+
+#   define A(buf) &(buf).digits[0]
+#   define B(buf) &(buf).digits[ndigits_max]
 
-#   define A(ptr) &(ptr)[0]
-#   define B(ptr) &(ptr)[ndigits_max]
+    struct arena const arena = { .nfields = TUPLE_LEN, .stride = ndigits_max };
+    struct arena_buf fib = arena_at(&arena, block, 0);
+    struct arena_buf accum = arena_at(&arena, block, 1);
+    struct arena_buf scratch = arena_at(&arena, block, 2);
 
-    DIGIT *fib = result.bytes;
-    DIGIT *accum = &fib[TUPLE_LEN * ndigits_max];
-    DIGIT *scratch = &fib[2 * TUPLE_LEN * ndigits_max];
+    // working memory for the subquadratic path
+    // (products fit in a field, and scratch is only needed below NTT_THRESHOLD)
+    size_t const prod_bytes = (ndigits_max + mul_scratch_len(ndigits_max < NTT_THRESHOLD ? ndigits_max : NTT_THRESHOLD)) * sizeof(DIGIT);
+    DIGIT *const prod = alloc_zeroed(prod_bytes);
+    DIGIT *const mul_scratch = &prod[ndigits_max];
 
     size_t fib_len = 1;
     size_t accum_len = 1;
 
     // init fib to identity
+    arena_clear(&arena, &fib, 1);
+    arena_clear(&arena, &accum, 1);
     *A(fib) = 1;
     *B(fib) = 0;
 
@@ -178,30 +179,103 @@ struct number fibonacci(uint64_t index)
         if (index & 1)
         {
             // fib *= accum
-            memset(scratch, 0, TUPLE_LEN * ndigits_max * sizeof(DIGIT));
+            // (the products, and the carry digit past them, fit in fib_len + accum_len + 1 digits)
+            arena_clear(&arena, &scratch, fib_len + accum_len + 1);
+
+            if (fib_len < KARATSUBA_THRESHOLD || accum_len < KARATSUBA_THRESHOLD)
+            {
+                // +[ a1a2, a1b2 ]
+                // +[ b1b2, b1b2 ]
+                // +[    0, b1a2 ]
+                multiply_twice(A(scratch), B(scratch), A(fib), A(accum), B(accum), fib_len, accum_len);
+                multiply_dup(A(scratch), B(scratch), B(fib), B(accum), fib_len, accum_len);
+                fib_len = multiply(B(scratch), B(fib), A(accum), fib_len, accum_len);
+            }
+            else
+            {
+                fib_len = multiply_fast(A(scratch), B(scratch), A(fib), B(fib), A(accum), B(accum),
+                        fib_len, accum_len, prod, mul_scratch);
+            }
+            arena_swap(&fib, &scratch);
+        }
+        if (index == 1)
+        {
+            // accum is no longer needed
+            break;
+        }
+
+        // accum *= accum
+        arena_clear(&arena, &scratch, 2 * accum_len + 1);
 
+        if (accum_len < KARATSUBA_THRESHOLD)
+        {
             // +[ a1a2, a1b2 ]
             // +[ b1b2, b1b2 ]
             // +[    0, b1a2 ]
-            multiply_twice(A(scratch), B(scratch), A(fib), A(accum), B(accum), fib_len, accum_len);
-            multiply_dup(A(scratch), B(scratch), B(fib), B(accum), fib_len, accum_len);
-            fib_len = multiply(B(scratch), B(fib), A(accum), fib_len, accum_len);
-            swap(&fib, &scratch);
+            multiply_twice(A(scratch), B(scratch), A(accum), A(accum), B(accum), accum_len, accum_len);
+            multiply_dup(A(scratch), B(scratch), B(accum), B(accum), accum_len, accum_len);
+            accum_len = multiply(B(scratch), B(accum), A(accum), accum_len, accum_len);
         }
-
-        // accum *= accum
-        memset(scratch, 0, TUPLE_LEN * ndigits_max * sizeof(DIGIT));
-
-        // +[ a1a2, a1b2 ]
-        // +[ b1b2, b1b2 ]
-        // +[    0, b1a2 ]
-        multiply_twice(A(scratch), B(scratch), A(accum), A(accum), B(accum), accum_len, accum_len);
-        multiply_dup(A(scratch), B(scratch), B(accum), B(accum), accum_len, accum_len);
-        accum_len = multiply(B(scratch), B(accum), A(accum), accum_len, accum_len);
-        swap(&accum, &scratch);
+        else
+        {
+            accum_len = multiply_fast(A(scratch), B(scratch), A(accum), B(accum), A(accum), B(accum),
+                    accum_len, accum_len, prod, mul_scratch);
+        }
+        arena_swap(&accum, &scratch);
     }
 
+    alloc_free(prod, prod_bytes);
+
     result.length = fib_len * sizeof(DIGIT);
-    memcpy(result.bytes, B(fib), result.length);
+    memcpy(block, B(fib), result.length);
+    // give back the other fields
+    result.bytes = alloc_keep(block, block_bytes, result.length);
     return result;
 }
+
+#ifdef MICRO_KERNELS
+#include "micro.h"
+
+static void micro_scale_accum(void *accum1, void *accum2, void const *a, void const *b, size_t const n)
+{
+    (void)accum2;
+    scale_accum(accum1, a, *(DIGIT const *)b, n);
+}
+
+static void micro_scale_accum_twice(void *accum1, void *accum2, void const *a, void const *b, size_t const n)
+{
+    DIGIT const *const scales = b;
+    scale_accum_twice(accum1, accum2, a, scales[0], scales[1], n);
+}
+
+static void micro_scale_accum_dup(void *accum1, void *accum2, void const *a, void const *b, size_t const n)
+{
+    scale_accum_dup(accum1, accum2, a, *(DIGIT const *)b, n);
+}
+
+static void micro_multiply(void *accum1, void *accum2, void const *a, void const *b, size_t const n)
+{
+    (void)accum2;
+    multiply(accum1, a, b, n, n);
+}
+
+static void micro_multiply_twice(void *accum1, void *accum2, void const *a, void const *b, size_t const n)
+{
+    multiply_twice(accum1, accum2, a, b, a, n, n);
+}
+
+static void micro_multiply_dup(void *accum1, void *accum2, void const *a, void const *b, size_t const n)
+{
+    multiply_dup(accum1, accum2, a, b, n, n);
+}
+
+struct micro_kernel const micro_kernels[] = {
+    { "scale_accum", sizeof(DIGIT), 0, micro_scale_accum },
+    { "scale_accum_twice", sizeof(DIGIT), 0, micro_scale_accum_twice },
+    { "scale_accum_dup", sizeof(DIGIT), 0, micro_scale_accum_dup },
+    { "multiply", sizeof(DIGIT), 1, micro_multiply },
+    { "multiply_twice", sizeof(DIGIT), 1, micro_multiply_twice },
+    { "multiply_dup", sizeof(DIGIT), 1, micro_multiply_dup },
+};
+size_t const micro_nkernels = sizeof(micro_kernels) / sizeof(*micro_kernels);
+#endif//MICRO_KERNELS
@@ -13,10 +13,23 @@
 
 #define TUPLE_LEN 2
 
-// crude estimate
+#include "mul/mul.h"
+#include "mul/arena.h"
+#include "fibcache.h"
+
+// states of the chain of at least FIB_CACHE_MIN_BYTES go to the cache (when
+// on, see fibcache.h): the smaller ones are quicker to recompute than to read
+#ifndef FIB_CACHE_MIN_BYTES
+#   define FIB_CACHE_MIN_BYTES (1 << 20)
+#endif
+
 static size_t ndigit_estimate(uint64_t const index)
 {
-    return (2*index + DIGIT_BIT - 1) / DIGIT_BIT + 2;
+    // fib holds (F_{k-1}, F_k) for prefixes k of index, and its square has
+    // (non-normalised) fields of twice the length of F_k, with 2k <= index;
+    // since F_k has at most (k - 1) log2(phi) + 1 bits, they fit (along with
+    // a carry digit) in fib_bits(index) / D + 5 digits.
+    return fib_bits(index) / DIGIT_BIT + 5;
 }
 
 // computes (*a) + (*b)
@@ -26,13 +39,20 @@ static unsigned sum(
         DIGIT const *const a, DIGIT const *const b,
         size_t const ndigits)
 {
-    size_t offset;
+    size_t offset = 0;
     unsigned carry = 0;
-    for (offset = 0; offset < ndigits; offset += 2)
+#   ifdef MUL_ADX
+    if (sizeof(DIGIT) == sizeof(uint64_t) && ndigits >= 8 && cpu_tier() >= CPU_AVX2)
+    {
+        carry = adx_add_n((uint64_t *)result, (uint64_t const *)a, (uint64_t const *)b, ndigits);
+        offset = ndigits / 4 * 4;
+    }
+#   endif
+    for (; offset < ndigits; offset += 2)
     {
         DBDGT tot;
-        carry = __builtin_add_overflow(*(DBDGT *)&a[offset], carry, &tot);
-        carry += __builtin_add_overflow(*(DBDGT *)&b[offset], tot, (DBDGT *)&result[offset]);
+        carry = __builtin_add_overflow(*(digit_pair *)&a[offset], carry, &tot);
+        carry += __builtin_add_overflow(*(digit_pair *)&b[offset], tot, (digit_pair *)&result[offset]);
     }
     result[offset] = carry;
     for (;; --offset)
@@ -44,72 +64,61 @@ static unsigned sum(
     }
 }
 
-// computes (*a) * scale and accumulates the result in accum1 and accum2
-static void scale_accum_dup(
-        DIGIT *restrict accum1, DIGIT *restrict accum2,
-        DIGIT const *const a, DBDGT const scale, size_t const ndigits)
-{
-    DBDGT carry1 = 0;
-    DBDGT carry2 = 0;
-    for (size_t offset = 0; offset < ndigits; ++offset)
-    {
-        DBDGT const prod = ((DBDGT)a[offset]) * scale;
-
-        DBDGT const acc1
-            = ((DBDGT)accum1[offset])
-            + prod
-            + carry1;
-        accum1[offset] = (DIGIT)acc1;
-        carry1 = acc1 >> DIGIT_BIT;
-
-        DBDGT const acc2
-            = ((DBDGT)accum2[offset])
-            + prod
-            + carry2;
-        accum2[offset] = (DIGIT)acc2;
-        carry2 = acc2 >> DIGIT_BIT;
-    }
-    *(DBDGT *)&accum1[ndigits] += carry1;
-    *(DBDGT *)&accum2[ndigits] += carry2;
-}
-
 // computes (*a) * (scale1, scale2) and accumulates the results in (accum1, accum2)
 static void scale_accum_twice(
         DIGIT *restrict accum1, DIGIT *restrict accum2,
         DIGIT const *const a, DBDGT const scale1, DBDGT const scale2, size_t const ndigits)
 {
-    DBDGT carry1 = 0;
-    DBDGT carry2 = 0;
-    for (size_t offset = 0; offset < ndigits; ++offset)
-    {
-        DBDGT const adig = a[offset];
+    // two rows of addmul_1 (each of which already interleaves two carry chains)
+    *(digit_pair *)&accum1[ndigits] += addmul_1(accum1, a, ndigits, (DIGIT)scale1);
+    *(digit_pair *)&accum2[ndigits] += addmul_1(accum2, a, ndigits, (DIGIT)scale2);
+}
 
-        DBDGT const acc1
-            = ((DBDGT)accum1[offset])
-            + adig * scale1
-            + carry1;
-        accum1[offset] = (DIGIT)acc1;
-        carry1 = acc1 >> DIGIT_BIT;
+// computes the off-diagonal half of (*a)^2, i.e. the sum of a[i] a[j] X^(i+j)
+// over i < j, and accumulates it in accum (2*ndigits digits, initially zero)
+static void square_halfdiag(
+        DIGIT *restrict accum,
+        DIGIT const *const a, size_t const ndigits)
+{
+    for (size_t offset = 0; offset + 1 < ndigits; ++offset)
+    {
+        DBDGT const scale = a[offset];
+        DIGIT const *const tail = &a[offset + 1];
+        DIGIT *const row = &accum[2 * offset + 1];
+        size_t const len = ndigits - offset - 1;
 
-        DBDGT const acc2
-            = ((DBDGT)accum2[offset])
-            + adig * scale2
-            + carry2;
-        accum2[offset] = (DIGIT)acc2;
-        carry2 = acc2 >> DIGIT_BIT;
+        // no earlier row reaches this far, so the carry is simply stored
+        row[len] = addmul_1(row, tail, len, (DIGIT)scale);
     }
-    *(DBDGT *)&accum1[ndigits] += carry1;
-    *(DBDGT *)&accum2[ndigits] += carry2;
 }
 
-// compute (*a)^2 and accumulate the result in accum1 and accum2
+// compute (*a)^2 and write the result to accum1 and accum2 (initially zero)
+// each product a[i] a[j] (i < j) is only computed once, and doubled by a shift
 static void square_dup(
         DIGIT *restrict accum1, DIGIT *restrict accum2,
         DIGIT const *const a, size_t const adigits)
 {
+    square_halfdiag(accum1, a, adigits);
+
+    // [ 2 * halfdiag + diag, 2 * halfdiag + diag ]
+    DIGIT spill = 0;
+    unsigned carry = 0;
     for (size_t offset = 0; offset < adigits; ++offset)
     {
-        scale_accum_dup(&accum1[offset], &accum2[offset], a, a[offset], adigits);
+        DIGIT const lo = accum1[2 * offset];
+        DIGIT const hi = accum1[2 * offset + 1];
+        DBDGT const twice
+            = ((DBDGT)((hi << 1) | (lo >> (DIGIT_BIT - 1))) << DIGIT_BIT)
+            | (DBDGT)((lo << 1) | spill);
+        spill = hi >> (DIGIT_BIT - 1);
+
+        DBDGT tot;
+        unsigned const c1 = __builtin_add_overflow(twice, ((DBDGT)a[offset]) * a[offset], &tot);
+        unsigned const c2 = __builtin_add_overflow(tot, (DBDGT)carry, &tot);
+        carry = c1 | c2;
+
+        accum1[2 * offset] = accum2[2 * offset] = (DIGIT)tot;
+        accum1[2 * offset + 1] = accum2[2 * offset + 1] = (DIGIT)(tot >> DIGIT_BIT);
     }
 }
 
@@ -137,14 +146,285 @@ static size_t multiply_twice(
     }
 }
 
-// as the name suggests
-static void swap(DIGIT **lhs, DIGIT **rhs)
+// computes (a^2 + b^2, 2ab + b^2) with the subquadratic multiplication engine,
+// and accumulates the results in (accum1, accum2)
+// prod must fit 2*ndigits digits, and scratch mul_scratch_len(ndigits) digits
+// returns the max number of digits between accum1 and accum2
+static size_t square_fast(
+        DIGIT *restrict accum1, DIGIT *restrict accum2,
+        DIGIT const *const a, DIGIT const *const b, size_t const ndigits,
+        DIGIT *restrict prod, DIGIT *restrict scratch)
+{
+    size_t const plen = 2 * ndigits;
+
+    // +[ b^2, b^2 ]
+    sqr_n(prod, b, ndigits, scratch);
+    add_accum(accum1, prod, normalised_len(prod, plen));
+    add_accum(accum2, prod, normalised_len(prod, plen));
+
+    // +[ a^2,   0 ]
+    sqr_n(prod, a, ndigits, scratch);
+    add_accum(accum1, prod, normalised_len(prod, plen));
+
+    // +[   0, 2ab ]
+    mul_n(prod, a, b, ndigits, scratch);
+    add_accum(accum2, prod, normalised_len(prod, plen));
+    add_accum(accum2, prod, normalised_len(prod, plen));
+
+    for (size_t len = plen;; --len)
+    {
+        if (accum1[len] || accum2[len])
+        {
+            return len + 1;
+        }
+    }
+}
+
+// [ a, b ] -> [ a^2 + b^2, 2ab + b^2 ], pointwise
+static void square_pointwise(
+        uint64_t *restrict x, uint64_t *restrict y,
+        size_t const begin, size_t const end, struct ntt_prime const *const prime)
+{
+    for (size_t i = begin; i < end; ++i)
+    {
+        uint64_t const yy = ntt_mulmod(y[i], y[i], prime);
+        uint64_t const xy = ntt_mulmod(x[i], y[i], prime);
+        x[i] = ntt_addmod(ntt_mulmod(x[i], x[i], prime), yy, prime);
+        y[i] = ntt_addmod(ntt_addmod(xy, xy, prime), yy, prime);
+    }
+}
+
+// computes (a^2 + b^2, 2ab + b^2) with number-theoretic transforms,
+// and writes the results to (accum1, accum2), 2*ndigits + 1 digits each
+// a and b are transformed once each, and the sums are formed pointwise,
+// so that the whole step costs two forward and two inverse transforms
+// (run prime by prime in the scratch of ntt, which is kept from one step to
+// the next, see ntt_pair)
+static void square_ntt(
+        DIGIT *restrict accum1, DIGIT *restrict accum2,
+        DIGIT const *const a, DIGIT const *const b, size_t const ndigits,
+        struct ntt *const ntt)
+{
+    size_t const plen = 2 * ndigits;
+    ntt_reserve(ntt, ntt_size(plen - 1), 2 * (plen + 1));
+    ntt_pair(ntt, accum1, plen + 1, accum2, plen + 1, a, ndigits, b, ndigits, square_pointwise);
+}
+
+#ifdef USE_FFT
+// computes (a^2 + b^2, 2ab + b^2) with a floating-point FFT,
+// and writes the results to (accum1, accum2), 2*ndigits + 1 digits each
+// a + Ib is transformed at once, and (a^2 + b^2) + I(2ab + b^2) is formed
+// pointwise, so that the whole step costs one forward and one inverse transform
+// returns 0 if the FFT is too imprecise
+static int square_fft(
+        DIGIT *restrict accum1, DIGIT *restrict accum2,
+        DIGIT const *const a, DIGIT const *const b, size_t const ndigits)
+{
+    size_t const plen = 2 * ndigits;
+    size_t const len = fft_size(plen);
+    if (len > FFT_MAX_LEN)
+    {
+        return 0;
+    }
+
+    struct fft ctx;
+    fft_init(&ctx, len);
+    double *const z = malloc(2 * len * sizeof(double));
+
+    fft_load(z, len, 0, a, ndigits);
+    fft_load(z, len, 1, b, ndigits);
+    fft_transform(&ctx, z, 0);
+    for (size_t k = 0; k <= len / 2; ++k)
+    {
+        struct cplx x, y;
+        fft_split(z, k, len, &x, &y);
+        struct cplx const yy = cplx_mul(y, y);
+        struct cplx const xy = cplx_mul(x, y);
+        fft_join(z, k, len, cplx_add(cplx_mul(x, x), yy), cplx_add(cplx_add(xy, xy), yy));
+    }
+    fft_transform(&ctx, z, 1);
+    int const ok
+        = fft_store(accum1, plen + 1, z, len, 0)
+        && fft_store(accum2, plen + 1, z, len, 1);
+
+    free(z);
+    fft_free(&ctx);
+    return ok;
+}
+#endif
+
+// computes (a^2 + b^2, 2ab + b^2) with transforms, and writes the results to
+// (accum1, accum2)
+// returns the max number of digits between accum1 and accum2
+static size_t square_transform(
+        DIGIT *restrict accum1, DIGIT *restrict accum2,
+        DIGIT const *const a, DIGIT const *const b, size_t const ndigits,
+        struct ntt *const ntt)
+{
+#   ifdef USE_FFT
+    if (!square_fft(accum1, accum2, a, b, ndigits))
+#   endif
+    {
+        square_ntt(accum1, accum2, a, b, ndigits, ntt);
+    }
+
+    for (size_t len = 2 * ndigits;; --len)
+    {
+        if (accum1[len] || accum2[len])
+        {
+            return len + 1;
+        }
+    }
+}
+
+#ifdef FIB_THREADS
+// state shared by the tasks of a threaded squaring step
+struct square_job {
+    DIGIT *accum1;
+    DIGIT *accum2;
+    DIGIT const *a;
+    DIGIT const *b;
+    size_t ndigits;
+    size_t nbands;
+    // carries out of each band
+    uint64_t *carries;
+
+    // products (2*ndigits digits each) and scratch for the engine
+    DIGIT *prods[3];
+    DIGIT *scratch[3];
+
+    // twiddle factors and scratch of the transforms
+    struct ntt *ntt;
+};
+
+// b^2, a^2 and ab, one per task
+static void square_products_task(void *arg, size_t const index)
 {
-    DIGIT *tmp = *lhs;
-    *lhs = *rhs;
-    *rhs = tmp;
+    struct square_job *const job = arg;
+    switch (index)
+    {
+    case 0:
+        sqr_n(job->prods[0], job->b, job->ndigits, job->scratch[0]);
+        break;
+    case 1:
+        sqr_n(job->prods[1], job->a, job->ndigits, job->scratch[1]);
+        break;
+    default:
+        mul_n(job->prods[2], job->a, job->b, job->ndigits, job->scratch[2]);
+        break;
+    }
+}
+
+// +[ b^2 + a^2, b^2 + 2ab ] over a band of digits
+static void square_bands_task(void *arg, size_t const index)
+{
+    struct square_job *const job = arg;
+    size_t const plen = 2 * job->ndigits;
+    size_t const begin = band_begin(plen, job->nbands, index);
+    size_t const end = band_begin(plen, job->nbands, index + 1);
+
+    DIGIT const *const bb = job->prods[0];
+    DIGIT const *const aa = job->prods[1];
+    DIGIT const *const ab = job->prods[2];
+
+    DBDGT carry1 = 0;
+    DBDGT carry2 = 0;
+    for (size_t offset = begin; offset < end; ++offset)
+    {
+        DBDGT const acc1
+            = ((DBDGT)job->accum1[offset])
+            + bb[offset]
+            + aa[offset]
+            + carry1;
+        job->accum1[offset] = (DIGIT)acc1;
+        carry1 = acc1 >> DIGIT_BIT;
+
+        DBDGT const acc2
+            = ((DBDGT)job->accum2[offset])
+            + bb[offset]
+            + ((DBDGT)ab[offset] << 1)
+            + carry2;
+        job->accum2[offset] = (DIGIT)acc2;
+        carry2 = acc2 >> DIGIT_BIT;
+    }
+    job->carries[2 * index] = (uint64_t)carry1;
+    job->carries[2 * index + 1] = (uint64_t)carry2;
 }
 
+// square_fast, with the three products (and then the sums) spread over the pool
+// prods must fit 3 * 2*ndigits digits, and scratch 3 * scratch_len digits
+static size_t square_fast_threaded(
+        DIGIT *restrict accum1, DIGIT *restrict accum2,
+        DIGIT const *const a, DIGIT const *const b, size_t const ndigits,
+        DIGIT *restrict prods, DIGIT *restrict scratch, size_t const scratch_len,
+        struct pool *const pool)
+{
+    size_t const plen = 2 * ndigits;
+    struct square_job job = {
+        .accum1 = accum1, .accum2 = accum2,
+        .a = a, .b = b, .ndigits = ndigits,
+        .nbands = pool->nthreads,
+    };
+    for (unsigned i = 0; i < 3; ++i)
+    {
+        job.prods[i] = &prods[i * plen];
+        job.scratch[i] = &scratch[i * scratch_len];
+    }
+    job.carries = malloc(2 * job.nbands * sizeof(uint64_t));
+
+    pool_run(pool, square_products_task, &job, 3);
+    pool_run(pool, square_bands_task, &job, job.nbands);
+
+    // propagate the carries out of the bands, in order
+    for (size_t i = 0; i < job.nbands; ++i)
+    {
+        size_t const end = band_begin(plen, job.nbands, i + 1);
+        add_carry(&accum1[end], (DIGIT)job.carries[2 * i]);
+        add_carry(&accum2[end], (DIGIT)job.carries[2 * i + 1]);
+    }
+    free(job.carries);
+
+    for (size_t len = plen;; --len)
+    {
+        if (accum1[len] || accum2[len])
+        {
+            return len + 1;
+        }
+    }
+}
+
+// square_ntt, as the single task of the pool (which its transforms fork from)
+static void square_ntt_task(void *arg, size_t const index)
+{
+    (void)index;
+    struct square_job *const job = arg;
+    square_ntt(job->accum1, job->accum2, job->a, job->b, job->ndigits, job->ntt);
+}
+
+// square_ntt, with the transforms (and the Chinese remainders) spread over the pool
+// returns the max number of digits between accum1 and accum2
+static size_t square_ntt_threaded(
+        DIGIT *restrict accum1, DIGIT *restrict accum2,
+        DIGIT const *const a, DIGIT const *const b, size_t const ndigits,
+        struct ntt *const ntt, struct pool *const pool)
+{
+    struct square_job job = {
+        .accum1 = accum1, .accum2 = accum2,
+        .a = a, .b = b, .ndigits = ndigits,
+        .ntt = ntt,
+    };
+    pool_run(pool, square_ntt_task, &job, 1);
+
+    for (size_t len = 2 * ndigits;; --len)
+    {
+        if (accum1[len] || accum2[len])
+        {
+            return len + 1;
+        }
+    }
+}
+#endif
+
 // return only the most significant set bit of x
 static uint64_t msb(uint64_t const x)
 {
@@ -152,58 +432,363 @@ static uint64_t msb(uint64_t const x)
     return 1llu << (63 - __builtin_clzll(x|1));
 }
 
-struct number fibonacci(uint64_t index)
+// the doubling chain: fib holds (F_{k-1}, F_k) for the prefixes k of an index,
+// along with the working memory of its steps (sized for indices up to some
+// maximum)
+struct chain {
+    struct arena arena;
+    DIGIT *block;
+    size_t block_bytes;
+    struct arena_buf fib;
+    struct arena_buf scratch;
+    size_t fib_len;
+
+    // working memory for the subquadratic path
+    DIGIT *prod;
+    size_t prod_bytes;
+    DIGIT *mul_scratch;
+    // twiddle factors and scratch of the transforms, for the longest one so far
+    struct ntt ntt;
+
+#   ifdef FIB_THREADS
+    struct pool pool;
+    // one product and one scratch buffer per task (only below NTT_THRESHOLD)
+    DIGIT *thread_prods;
+    DIGIT *thread_scratch;
+    size_t thread_scratch_len;
+#   endif
+};
+
+#define A(buf) &(buf).digits[0]
+#define B(buf) &(buf).digits[ndigits_max]
+
+// arguments of chain_alloc_task
+struct chain_alloc {
+    struct chain *chain;
+    uint64_t max_index;
+};
+
+// allocates the big blocks of a chain for indices up to max_index (its
+// block_bytes and prod_bytes set): run on the pool of the chain in threaded
+// builds, so that they are first touched by its threads (see alloc.h)
+static void chain_alloc_task(void *arg, size_t const index)
 {
-    size_t ndigits_max = ndigit_estimate(index);
+    (void)index;
+    struct chain_alloc const *const job = arg;
+    struct chain *const chain = job->chain;
 
-    uint64_t mask = msb(index);
+    chain->block = alloc_zeroed(chain->block_bytes);
+    chain->prod = alloc_zeroed(chain->prod_bytes);
 
-    struct number result;
-    result.bytes = calloc(2 * TUPLE_LEN * ndigits_max, sizeof(DIGIT));
+    // each squaring transforms twice the digits of the previous one, so the
+    // transforms are set up once, for the last squaring (that of F_k, with
+    // 2k <= max_index), rather than grown step after step
+    chain->ntt = (struct ntt){ 0 };
+    size_t const last_len = ndigit_estimate(job->max_index >> 1);
+    if (last_len >= NTT_THRESHOLD)
+    {
+        ntt_reserve(&chain->ntt, ntt_size(2 * last_len - 1), 2 * (2 * last_len + 1));
+    }
+}
 
-#   define A(ptr) &(ptr)[0]
-#   define B(ptr) &(ptr)[ndigits_max]
+// sets up a chain for indices up to max_index, at k = 0
+static void chain_init(struct chain *const chain, uint64_t const max_index)
+{
+    size_t const ndigits_max = ndigit_estimate(max_index);
+    chain->block_bytes = 2 * TUPLE_LEN * ndigits_max * sizeof(DIGIT);
+    // (products fit in a field, and scratch is only needed below NTT_THRESHOLD)
+    chain->prod_bytes = (ndigits_max + mul_scratch_len(ndigits_max < NTT_THRESHOLD ? ndigits_max : NTT_THRESHOLD)) * sizeof(DIGIT);
+
+    struct chain_alloc job = { .chain = chain, .max_index = max_index };
+#   ifdef FIB_THREADS
+    // the pool comes first, for the big blocks to be allocated on it
+    pool_init(&chain->pool, FIB_THREADS);
+    pool_run(&chain->pool, chain_alloc_task, &job, 1);
 
-    DIGIT *fib = result.bytes;
-    DIGIT *scratch = &fib[TUPLE_LEN * ndigits_max];
+    size_t const thread_len = ndigits_max < NTT_THRESHOLD ? ndigits_max : NTT_THRESHOLD;
+    chain->thread_scratch_len = mul_scratch_len(thread_len);
+    chain->thread_prods = malloc(3 * (2 * thread_len + chain->thread_scratch_len) * sizeof(DIGIT));
+    chain->thread_scratch = &chain->thread_prods[3 * 2 * thread_len];
+#   else
+    chain_alloc_task(&job, 0);
+#   endif
 
-    size_t fib_len = 1;
+    chain->arena = (struct arena){ .nfields = TUPLE_LEN, .stride = ndigits_max };
+    chain->fib = arena_at(&chain->arena, chain->block, 0);
+    chain->scratch = arena_at(&chain->arena, chain->block, 1);
+    chain->mul_scratch = &chain->prod[ndigits_max];
 
     // init fib to identity
-    *A(fib) = 1;
-    *B(fib) = 0;
+    chain->fib_len = 1;
+    arena_clear(&chain->arena, &chain->fib, 1);
+    *A(chain->fib) = 1;
+    *B(chain->fib) = 0;
+}
 
-    for (; mask; mask >>= 1)
-    {
-        // fib *= fib
-        memset(scratch, 0, TUPLE_LEN * ndigits_max * sizeof(DIGIT));
+// frees the working memory of the chain (but not its block)
+static void chain_free_work(struct chain *const chain)
+{
+    alloc_free(chain->prod, chain->prod_bytes);
+    ntt_free(&chain->ntt);
+#   ifdef FIB_THREADS
+    free(chain->thread_prods);
+    pool_free(&chain->pool);
+#   endif
+}
 
+// k -> 2k
+static void chain_square(struct chain *const chain)
+{
+    size_t const ndigits_max = chain->arena.stride;
+    struct arena_buf const fib = chain->fib;
+    size_t fib_len = chain->fib_len;
+
+    // fib *= fib
+    // (the squares, and the carry digit past them, fit in 2 * fib_len + 1 digits)
+    struct arena_buf scratch = chain->scratch;
+    arena_clear(&chain->arena, &scratch, 2 * fib_len + 1);
+
+    debugmem(B(fib), fib_len * sizeof(DIGIT));
+    debug(" **2 + 2 * ");
+    debugmem(A(fib), fib_len * sizeof(DIGIT));
+    debug(" * ");
+    debugmem(B(fib), fib_len * sizeof(DIGIT));
+    debug(" = ");
+    if (fib_len < KARATSUBA_THRESHOLD)
+    {
         // +[ b^2, b^2 ]
         // +[ a^2, 2ab ]
         square_dup(A(scratch), B(scratch), B(fib), fib_len);
-        debugmem(B(fib), fib_len * sizeof(DIGIT));
-        debug(" **2 + 2 * ");
-        debugmem(A(fib), fib_len * sizeof(DIGIT));
-        debug(" * ");
-        debugmem(B(fib), fib_len * sizeof(DIGIT));
-        debug(" = ");
         fib_len = multiply_twice(A(scratch), B(scratch), A(fib), A(fib), B(fib), fib_len, fib_len);
-        debugmem(B(scratch), fib_len * sizeof(DIGIT));
-        debug("\n");
-        log("fib_len: %llu\n", (long long unsigned)fib_len);
-        swap(&fib, &scratch);
+    }
+#   ifdef FIB_THREADS
+    else if (fib_len >= FIB_THREADS_THRESHOLD && fib_len < NTT_THRESHOLD)
+    {
+        fib_len = square_fast_threaded(
+                A(scratch), B(scratch), A(fib), B(fib), fib_len,
+                chain->thread_prods, chain->thread_scratch, chain->thread_scratch_len, &chain->pool);
+    }
+    else if (fib_len >= FIB_THREADS_THRESHOLD)
+    {
+        fib_len = square_ntt_threaded(A(scratch), B(scratch), A(fib), B(fib), fib_len, &chain->ntt, &chain->pool);
+    }
+#   endif
+    else if (fib_len < NTT_THRESHOLD)
+    {
+        fib_len = square_fast(A(scratch), B(scratch), A(fib), B(fib), fib_len, chain->prod, chain->mul_scratch);
+    }
+    else
+    {
+        fib_len = square_transform(A(scratch), B(scratch), A(fib), B(fib), fib_len, &chain->ntt);
+    }
+    debugmem(B(scratch), fib_len * sizeof(DIGIT));
+    debug("\n");
+    log("fib_len: %llu\n", (long long unsigned)fib_len);
+
+    chain->scratch = fib;
+    chain->fib = scratch;
+    chain->fib_len = fib_len;
+}
+
+// k -> k + 1
+static void chain_add(struct chain *const chain)
+{
+    size_t const ndigits_max = chain->arena.stride;
+    struct arena_buf const fib = chain->fib;
+
+    // [b, a+b]
+    // (sum writes up to two digits past fib_len, rounding up to whole DBDGTs)
+    struct arena_buf scratch = chain->scratch;
+    arena_clear(&chain->arena, &scratch, chain->fib_len + 2);
+    memcpy(A(scratch), B(fib), chain->fib_len * sizeof(DIGIT));
+    //fib_len += sum((DBDGT *)B(scratch), (DBDGT *)A(fib), (DBDGT *)B(fib), fib_len);
+    chain->fib_len = sum(B(scratch), A(fib), B(fib), chain->fib_len);
+
+    chain->scratch = fib;
+    chain->fib = scratch;
+}
+
+struct number fibonacci(uint64_t index)
+{
+    struct chain chain;
+    chain_init(&chain, index);
+    size_t const ndigits_max = chain.arena.stride;
 
+    uint64_t mask = msb(index);
+    int const cache = fib_cache_enabled();
+    unsigned const cache_every = cache ? fib_cache_every() : 0;
+    struct fib_cache_entry cached;
+    if (cache && fib_cache_find(index, sizeof(DIGIT), ndigits_max, &cached))
+    {
+        // resume from the longest prefix of index in the cache
+        arena_clear(&chain.arena, &chain.fib, cached.ndigits);
+        memcpy(A(chain.fib), cached.fields[0], cached.ndigits * sizeof(DIGIT));
+        memcpy(B(chain.fib), cached.fields[1], cached.ndigits * sizeof(DIGIT));
+        chain.fib_len = cached.ndigits;
+        mask = cached.shift ? 1llu << (cached.shift - 1) : 0;
+        fib_cache_release(&cached);
+    }
+
+    for (; mask; mask >>= 1)
+    {
+        chain_square(&chain);
         if (index & mask)
         {
-            // [b, a+b]
-            memcpy(A(scratch), B(fib), fib_len * sizeof(DIGIT));
-            //fib_len += sum((DBDGT *)B(scratch), (DBDGT *)A(fib), (DBDGT *)B(fib), fib_len);
-            fib_len = sum(B(scratch), A(fib), B(fib), fib_len);
-            swap(&fib, &scratch);
+            chain_add(&chain);
+        }
+        // (the final state, and every cache_every-th step before it)
+        unsigned const steps_left = __builtin_ctzll(mask);
+        if (cache && (steps_left == 0 || (cache_every && steps_left % cache_every == 0))
+            && 2 * chain.fib_len * sizeof(DIGIT) >= FIB_CACHE_MIN_BYTES)
+        {
+            fib_cache_store(index >> steps_left, sizeof(DIGIT), A(chain.fib), B(chain.fib), chain.fib_len);
         }
     }
+    chain_free_work(&chain);
+    if (cache)
+    {
+        fib_cache_evict();
+    }
 
-    result.length = fib_len * sizeof(DIGIT);
-    memcpy(result.bytes, B(fib), result.length);
+    struct number result;
+    result.length = chain.fib_len * sizeof(DIGIT);
+    memcpy(chain.block, B(chain.fib), result.length);
+    // give back the other fields
+    result.bytes = alloc_keep(chain.block, chain.block_bytes, result.length);
     return result;
 }
+
+// Batches walk the binary trie of their indices (from the most significant
+// bit) with a single chain: indices sharing their leading bits share the
+// steps of that prefix, and where the trie branches, the squared state is
+// saved (at its current, small length), the chain goes down the 0 branch,
+// then comes back to the saved state for the 1 branch. The saved states on
+// the current path at most double in length from one to the next, so they
+// take less than twice the largest of them, on top of the chain itself
+// (sized for the largest index).
+
+struct batch_entry {
+    uint64_t index;
+    size_t slot; // in results
+};
+
+static int batch_entry_cmp(void const *lhs, void const *rhs)
+{
+    uint64_t const l = ((struct batch_entry const *)lhs)->index;
+    uint64_t const r = ((struct batch_entry const *)rhs)->index;
+    return (l > r) - (l < r);
+}
+
+// computes the entries [lo, hi) (sorted), which share the bits of their index
+// above mask (as the prefix of chain)
+static void batch_walk(
+        struct chain *const chain, struct batch_entry const *const entries,
+        size_t lo, size_t const hi, uint64_t mask,
+        struct number *const results)
+{
+    size_t const ndigits_max = chain->arena.stride;
+
+    for (; mask; mask >>= 1)
+    {
+        chain_square(chain);
+
+        // first entry with this bit set
+        size_t mid = lo;
+        while (mid < hi && !(entries[mid].index & mask))
+        {
+            ++mid;
+        }
+        if (mid == hi)
+        {
+            continue;
+        }
+        if (mid > lo)
+        {
+            // branch: save the squared state, and go down the 0 branch first
+            size_t const saved_len = chain->fib_len;
+            DIGIT *const saved = malloc(2 * saved_len * sizeof(DIGIT));
+            memcpy(saved, A(chain->fib), saved_len * sizeof(DIGIT));
+            memcpy(&saved[saved_len], B(chain->fib), saved_len * sizeof(DIGIT));
+
+            batch_walk(chain, entries, lo, mid, mask >> 1, results);
+
+            arena_clear(&chain->arena, &chain->fib, saved_len);
+            memcpy(A(chain->fib), saved, saved_len * sizeof(DIGIT));
+            memcpy(B(chain->fib), &saved[saved_len], saved_len * sizeof(DIGIT));
+            chain->fib_len = saved_len;
+            free(saved);
+            lo = mid;
+        }
+        chain_add(chain);
+    }
+
+    // all of [lo, hi) have the same index
+    size_t const length = chain->fib_len * sizeof(DIGIT);
+    for (size_t entry = lo; entry < hi; ++entry)
+    {
+        struct number *const result = &results[entries[entry].slot];
+        result->length = length;
+        result->bytes = malloc(length);
+        memcpy(result->bytes, B(chain->fib), length);
+    }
+}
+
+void fibonacci_batch(uint64_t const *const indices, size_t const count, struct number *const results)
+{
+    if (!count)
+    {
+        return;
+    }
+
+    struct batch_entry *const entries = malloc(count * sizeof(*entries));
+    for (size_t entry = 0; entry < count; ++entry)
+    {
+        entries[entry] = (struct batch_entry){ .index = indices[entry], .slot = entry };
+    }
+    qsort(entries, count, sizeof(*entries), batch_entry_cmp);
+
+    uint64_t const max_index = entries[count - 1].index;
+    struct chain chain;
+    chain_init(&chain, max_index);
+
+    batch_walk(&chain, entries, 0, count, max_index ? msb(max_index) : 0, results);
+
+    chain_free_work(&chain);
+    alloc_free(chain.block, chain.block_bytes);
+    free(entries);
+}
+
+#ifdef MICRO_KERNELS
+#include "micro.h"
+
+static void micro_sum(void *accum1, void *accum2, void const *a, void const *b, size_t const n)
+{
+    (void)accum2;
+    sum(accum1, a, b, n);
+}
+
+static void micro_scale_accum_twice(void *accum1, void *accum2, void const *a, void const *b, size_t const n)
+{
+    DIGIT const *const scales = b;
+    scale_accum_twice(accum1, accum2, a, scales[0], scales[1], n);
+}
+
+static void micro_square_dup(void *accum1, void *accum2, void const *a, void const *b, size_t const n)
+{
+    (void)b;
+    square_dup(accum1, accum2, a, n);
+}
+
+static void micro_multiply_twice(void *accum1, void *accum2, void const *a, void const *b, size_t const n)
+{
+    multiply_twice(accum1, accum2, a, b, a, n, n);
+}
+
+struct micro_kernel const micro_kernels[] = {
+    { "sum", sizeof(DIGIT), 0, micro_sum },
+    { "scale_accum_twice", sizeof(DIGIT), 0, micro_scale_accum_twice },
+    { "square_dup", sizeof(DIGIT), 1, micro_square_dup },
+    { "multiply_twice", sizeof(DIGIT), 1, micro_multiply_twice },
+};
+size_t const micro_nkernels = sizeof(micro_kernels) / sizeof(*micro_kernels);
+#endif//MICRO_KERNELS
@@ -11,9 +11,9 @@
 // (crudely) approximates the number of digits necessary to store the "index"th Fibonacci number
 static size_t ndigit_estimate(uint64_t const index)
 {
-    // Simple induction implies that the nth Fibonacci number fits in (n-1) bits (so long as n > 1).
+    // The nth Fibonacci number fits in fib_bits(n) bits (see fib_base.h).
     // Moreover, add another digit for writing the final "carry" digit (even if that digit is zero).
-    return (index + DIGIT_BIT - 1) / DIGIT_BIT + 1;
+    return (fib_bits(index) + DIGIT_BIT - 1) / DIGIT_BIT + 1;
 }
 
 // computes a += b
@@ -63,6 +63,24 @@ struct number fibonacci(uint64_t index)
 
     result.length = ndigits * sizeof(DIGIT);
     memcpy(result.bytes, cur, result.length);
+    // give back the other buffer
+    result.bytes = realloc(result.bytes, result.length);
     return result;
 }
 
+
+#ifdef MICRO_KERNELS
+#include "micro.h"
+
+static void micro_accumulate(void *accum1, void *accum2, void const *a, void const *b, size_t const n)
+{
+    (void)accum2;
+    (void)b;
+    accumulate(accum1, a, n);
+}
+
+struct micro_kernel const micro_kernels[] = {
+    { "accumulate", sizeof(DIGIT), 0, micro_accumulate },
+};
+size_t const micro_nkernels = sizeof(micro_kernels) / sizeof(*micro_kernels);
+#endif//MICRO_KERNELS
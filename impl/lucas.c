@@ -0,0 +1,211 @@
+#include "fib_base.h"
+
+#if defined(DEBUG) || defined(ONLY64)
+#   define DIGIT uint32_t
+#   define DBDGT uint64_t
+#else
+#   define DIGIT uint64_t
+#   define DBDGT __uint128_t
+#endif
+
+#define DIGIT_BIT (CHAR_BIT * sizeof(DIGIT))
+#define DBDGT_BIT (CHAR_BIT * sizeof(DBDGT))
+
+#include "mul/mul.h"
+
+static size_t ndigit_estimate(uint64_t const index)
+{
+    // Each buffer must fit the (non-normalised) square of L_{k+1}, with
+    // 2k <= index, as well as a couple of carry digits; since L_{k+1} has at
+    // most (k + 1) log2(phi) + 1 bits, fib_bits(index + 2) / D + 5 digits are
+    // enough.
+    return fib_bits(index + 2) / DIGIT_BIT + 5;
+}
+
+// adds 2 (-1)^negative to (*a), in place
+// (the caller guarantees that the result is nonnegative, and fits)
+static void add_two(DIGIT *a, unsigned const negative)
+{
+    if (!negative)
+    {
+        add_carry(a, 2);
+        return;
+    }
+
+    DIGIT borrow = 2;
+    while (borrow)
+    {
+        borrow = __builtin_sub_overflow(*a, borrow, a);
+        ++a;
+    }
+}
+
+// computes (*a) - (*b), where (*b) has bdigits <= adigits digits
+// (the caller guarantees that the result is nonnegative)
+// returns the number of digits in the result
+static size_t difference(
+        DIGIT *restrict result,
+        DIGIT const *const a, DIGIT const *const b,
+        size_t const adigits, size_t const bdigits)
+{
+    DIGIT borrow = sub_n(result, a, b, bdigits);
+    for (size_t offset = bdigits; offset < adigits; ++offset)
+    {
+        borrow = __builtin_sub_overflow(a[offset], borrow, &result[offset]);
+    }
+    return normalised_len(result, adigits);
+}
+
+// computes 2 * (*a) - (*b) in place, where (*b) has bdigits <= adigits digits
+// (the caller guarantees that the result is nonnegative)
+// returns the number of digits in the result
+static size_t double_sub(
+        DIGIT *restrict a, DIGIT const *restrict b,
+        size_t const adigits, size_t const bdigits)
+{
+    DIGIT spill = 0;
+    unsigned borrow = 0;
+    for (size_t offset = 0; offset < adigits; ++offset)
+    {
+        DIGIT const digit = a[offset];
+        DIGIT const twice = (digit << 1) | spill;
+        spill = digit >> (DIGIT_BIT - 1);
+
+        DIGIT diff;
+        unsigned const b1 = __builtin_sub_overflow(twice, offset < bdigits ? b[offset] : 0, &diff);
+        unsigned const b2 = __builtin_sub_overflow(diff, (DIGIT)borrow, &a[offset]);
+        borrow = b1 | b2;
+    }
+    a[adigits] = spill - borrow;
+    return normalised_len(a, adigits + 1);
+}
+
+// [ a, b ] -> [ a^2, b^2 ], pointwise
+static void square_pointwise(
+        uint64_t *restrict x, uint64_t *restrict y,
+        size_t const begin, size_t const end, struct ntt_prime const *const prime)
+{
+    for (size_t i = begin; i < end; ++i)
+    {
+        x[i] = ntt_mulmod(x[i], x[i], prime);
+        y[i] = ntt_mulmod(y[i], y[i], prime);
+    }
+}
+
+// computes (*a)^2 and (*b)^2 with number-theoretic transforms, and writes
+// the results to (sqr_a, sqr_b), 2*ndigits digits each
+// (run prime by prime in the scratch of ntt, see ntt_pair)
+static void square_ntt(
+        DIGIT *restrict sqr_a, DIGIT *restrict sqr_b,
+        DIGIT const *const a, DIGIT const *const b, size_t const ndigits,
+        struct ntt *const ntt)
+{
+    ntt_reserve(ntt, ntt_size(2 * ndigits - 1), 4 * ndigits);
+    ntt_pair(ntt, sqr_a, 2 * ndigits, sqr_b, 2 * ndigits, a, ndigits, b, ndigits, square_pointwise);
+}
+
+// as the name suggests
+static void swap(DIGIT **lhs, DIGIT **rhs)
+{
+    DIGIT *tmp = *lhs;
+    *lhs = *rhs;
+    *rhs = tmp;
+}
+
+// return only the most significant set bit of x
+static uint64_t msb(uint64_t const x)
+{
+    // __builtin_clzll(0) is undefined
+    return 1llu << (63 - __builtin_clzll(x|1));
+}
+
+struct number fibonacci(uint64_t index)
+{
+    size_t const ndigits_max = ndigit_estimate(index);
+    log("Allocating %llu bytes per field.\n",
+            (long long unsigned)(ndigits_max * sizeof(DIGIT)));
+
+    uint64_t mask = msb(index);
+
+    struct number result;
+    size_t const block_bytes = 4 * ndigits_max * sizeof(DIGIT);
+    DIGIT *const block = alloc_zeroed(block_bytes);
+
+    // (lucas0, lucas1) = (L_k, L_{k+1}), and (sqr0, sqr1) hold their squares
+    DIGIT *lucas0 = block;
+    DIGIT *lucas1 = &lucas0[ndigits_max];
+    DIGIT *sqr0 = &lucas1[ndigits_max];
+    DIGIT *sqr1 = &sqr0[ndigits_max];
+
+    // (scratch is only needed below NTT_THRESHOLD)
+    DIGIT *const scratch = malloc(mul_scratch_len(ndigits_max < NTT_THRESHOLD ? ndigits_max : NTT_THRESHOLD) * sizeof(DIGIT));
+    // twiddle factors and scratch of the transforms, set up once for the
+    // longest squares (which fit in a field)
+    struct ntt ntt = { 0 };
+    if (ndigits_max >= 2 * NTT_THRESHOLD)
+    {
+        ntt_reserve(&ntt, ntt_size(ndigits_max - 1), 2 * ndigits_max);
+    }
+
+    size_t len = 1;
+    unsigned parity = 0;
+
+    // (L_0, L_1)
+    *lucas0 = 2;
+    *lucas1 = 1;
+
+    for (; mask; mask >>= 1)
+    {
+        // L_{2k}   = L_k^2     - 2(-1)^k
+        // L_{2k+2} = L_{k+1}^2 + 2(-1)^k
+        // L_{2k+1} = L_{2k+2} - L_{2k}
+        // (L_k and L_{k+1} are zero-extended to the same length)
+        if (len < NTT_THRESHOLD)
+        {
+            sqr_n(sqr0, lucas0, len, scratch);
+            sqr_n(sqr1, lucas1, len, scratch);
+        }
+        else
+        {
+            square_ntt(sqr0, sqr1, lucas0, lucas1, len, &ntt);
+        }
+        add_two(sqr0, !parity);
+        add_two(sqr1, parity);
+        size_t const len0 = normalised_len(sqr0, 2 * len);
+        size_t const len1 = normalised_len(sqr1, 2 * len);
+        size_t const mid_len = difference(lucas1, sqr1, sqr0, len1, len0);
+
+        if (index & mask)
+        {
+            // (L_{2k+1}, L_{2k+2})
+            swap(&lucas0, &lucas1);
+            swap(&lucas1, &sqr1);
+            len = len1;
+            memset(&lucas0[mid_len], 0, (len - mid_len) * sizeof(DIGIT));
+            parity = 1;
+        }
+        else
+        {
+            // (L_{2k}, L_{2k+1})
+            swap(&lucas0, &sqr0);
+            len = mid_len;
+            memset(&lucas0[len0], 0, (len - len0) * sizeof(DIGIT));
+            parity = 0;
+        }
+        log("len: %llu\n", (long long unsigned)len);
+    }
+
+    free(scratch);
+    ntt_free(&ntt);
+
+    // F_n = (L_{n-1} + L_{n+1}) / 5 = (2L_{n+1} - L_n) / 5
+    size_t fib_len = double_sub(lucas1, lucas0, len, len);
+    tc_divexact_1(lucas1, 5, fib_len);
+    fib_len = normalised_len(lucas1, fib_len);
+
+    result.length = fib_len * sizeof(DIGIT);
+    memmove(block, lucas1, result.length);
+    // give back the other buffers
+    result.bytes = alloc_keep(block, block_bytes, result.length);
+    return result;
+}
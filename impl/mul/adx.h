@@ -0,0 +1,154 @@
+#ifndef ADX_H
+#define ADX_H
+
+// BMI2/ADX rows of the grade-school product (included by mul.h).
+//
+// A row accum += a * scale has two carry chains per digit: adding the high
+// half of the previous product to the low half of this one, and adding that to
+// the accumulator. mulx leaves the flags alone, and adcx/adox only propagate
+// CF and OF respectively, so the two chains interleave without ever spilling
+// a flag to a register. The loop counter is stepped with lea and tested with
+// jrcxz, which do not touch the flags either.
+//
+// The rows are unrolled by 8 digits (with a block of 4, then a portable tail),
+// and alternate two registers for the high halves, so that each digit costs
+// one mulx, one adcx, one adox and a store.
+// Additions (add_n, and fastsquaring's sum) get a plain adc chain, unrolled
+// by 4 digits, whose loop keeps CF alive the same way.
+// Being inline assembly, they do not depend on the target of the build, and
+// are used whenever cpu_tier() >= CPU_AVX2 (see cpu.h).
+// Build with DEFINES="NO_ADX" to leave them out.
+
+#if defined(__x86_64__) && !defined(NO_ADX)
+#   define MUL_ADX
+#endif
+
+#ifdef MUL_ADX
+
+// one digit of the row: lo = a[i] * scale, accum[i] += lo + hi_prev (+ flags)
+#define ADX_STEP(offset, hi, hi_prev)\
+    "mulx " #offset "(%[a]), %[lo], %[" #hi "]\n\t"\
+    "adcx %[" #hi_prev "], %[lo]\n\t"\
+    "adox " #offset "(%[accum]), %[lo]\n\t"\
+    "mov %[lo], " #offset "(%[accum])\n\t"
+
+#define ADX_STEP4(base)\
+    ADX_STEP(base +  0, hi0, hi1)\
+    ADX_STEP(base +  8, hi1, hi0)\
+    ADX_STEP(base + 16, hi0, hi1)\
+    ADX_STEP(base + 24, hi1, hi0)
+
+// accumulates (*a) * scale in (*accum), over nblocks (> 0) blocks of 8 digits,
+// on top of an incoming carry digit; returns the carry digit
+static inline uint64_t adx_addmul_8(
+        uint64_t *accum, uint64_t const *a, size_t nblocks,
+        uint64_t const scale, uint64_t carry)
+{
+    uint64_t lo, hi0, zero;
+    __asm__ (
+        "xor %k[zero], %k[zero]\n\t" // also clears CF and OF
+        "1:\n\t"
+        ADX_STEP4(0)
+        ADX_STEP4(32)
+        "lea 64(%[a]), %[a]\n\t"
+        "lea 64(%[accum]), %[accum]\n\t"
+        "lea -1(%[count]), %[count]\n\t"
+        "jrcxz 2f\n\t"
+        "jmp 1b\n"
+        "2:\n\t"
+        "adcx %[zero], %[hi1]\n\t"
+        "adox %[zero], %[hi1]\n\t"
+        : [accum] "+&r" (accum), [a] "+&r" (a), [count] "+&c" (nblocks),
+          [hi1] "+&r" (carry), [hi0] "=&r" (hi0), [lo] "=&r" (lo), [zero] "=&r" (zero)
+        : [scale] "d" (scale)
+        : "cc", "memory");
+    return carry;
+}
+
+// same, for a single block of 4 digits
+static inline uint64_t adx_addmul_4(
+        uint64_t *accum, uint64_t const *a,
+        uint64_t const scale, uint64_t carry)
+{
+    uint64_t lo, hi0, zero;
+    __asm__ (
+        "xor %k[zero], %k[zero]\n\t"
+        ADX_STEP4(0)
+        "adcx %[zero], %[hi1]\n\t"
+        "adox %[zero], %[hi1]\n\t"
+        : [hi1] "+&r" (carry), [hi0] "=&r" (hi0), [lo] "=&r" (lo), [zero] "=&r" (zero)
+        : [accum] "r" (accum), [a] "r" (a), [scale] "d" (scale)
+        : "cc", "memory");
+    return carry;
+}
+
+#undef ADX_STEP4
+#undef ADX_STEP
+
+// accumulates (*a) * scale in the first (ndigits rounded down to a multiple
+// of 4) digits of (*accum); returns the carry digit out of them
+static inline uint64_t adx_addmul_1(
+        uint64_t *const accum, uint64_t const *const a,
+        size_t const ndigits, uint64_t const scale)
+{
+    uint64_t carry = 0;
+    size_t offset = 0;
+    if (ndigits >= 8)
+    {
+        carry = adx_addmul_8(accum, a, ndigits / 8, scale, carry);
+        offset = ndigits / 8 * 8;
+    }
+    if (ndigits - offset >= 4)
+    {
+        carry = adx_addmul_4(&accum[offset], &a[offset], scale, carry);
+    }
+    return carry;
+}
+
+// one digit of the sum: result[i] = a[i] + b[i] + CF
+#define ADX_ADD(offset)\
+    "mov " #offset "(%[a]), %[t]\n\t"\
+    "adc " #offset "(%[b]), %[t]\n\t"\
+    "mov %[t], " #offset "(%[result])\n\t"
+
+// computes (*a) + (*b) over the first (ndigits rounded down to a multiple of
+// 4) digits; returns the carry out of them
+// (result may be a or b, but must not otherwise overlap them)
+static inline uint64_t adx_add_n(
+        uint64_t *result, uint64_t const *a, uint64_t const *b,
+        size_t ndigits)
+{
+    size_t nblocks = ndigits / 4;
+    if (!nblocks)
+    {
+        return 0;
+    }
+    uint64_t t;
+    __asm__ (
+        "clc\n\t"
+        "1:\n\t"
+        ADX_ADD(0)
+        ADX_ADD(8)
+        ADX_ADD(16)
+        ADX_ADD(24)
+        "lea 32(%[a]), %[a]\n\t"
+        "lea 32(%[b]), %[b]\n\t"
+        "lea 32(%[result]), %[result]\n\t"
+        "lea -1(%[count]), %[count]\n\t"
+        "jrcxz 2f\n\t"
+        "jmp 1b\n"
+        "2:\n\t"
+        "mov $0, %k[t]\n\t"
+        "adc %k[t], %k[t]\n\t"
+        : [result] "+&r" (result), [a] "+&r" (a), [b] "+&r" (b),
+          [count] "+&c" (nblocks), [t] "=&r" (t)
+        :
+        : "cc", "memory");
+    return t;
+}
+
+#undef ADX_ADD
+
+#endif//MUL_ADX
+
+#endif//ADX_H
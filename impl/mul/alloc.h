@@ -0,0 +1,229 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+// Allocation of big digit buffers (included by mul.h, after pool.h).
+//
+// Blocks of at least FIB_BIG_ALLOC bytes can be mapped directly, instead of
+// going through calloc, depending on the page policy:
+// - FIB_PAGES=0: calloc and free, as everywhere else;
+// - FIB_PAGES=1: anonymous mappings, advised to use transparent huge pages;
+// - FIB_PAGES=2: explicit huge pages (MAP_HUGETLB), falling back to 1 when
+//   none are reserved.
+// With FIB_NUMA=1, mapped blocks are also interleaved over the online NUMA
+// nodes (mbind), instead of landing on whichever node touches them first.
+// Both are build-time defaults (DEFINES="FIB_PAGES=1 FIB_NUMA=1"), which the
+// environment variables of the same names override at run time.
+//
+// When allocated from a task on a pool (see pool.h), mapped blocks are first
+// touched in parallel, one band per thread, mirroring how the engine splits
+// its sums and transforms into bands; threaded implementations thus start
+// their pool before allocating their big blocks (with alloc_zeroed_on, or
+// from a task of their own).
+//
+// Mapped blocks cannot be handed to free(), so implementations return their
+// results through alloc_keep, which falls back to a copy when needed.
+
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef FIB_PAGES
+#   define FIB_PAGES 0
+#endif
+#ifndef FIB_NUMA
+#   define FIB_NUMA 0
+#endif
+// smaller blocks always go through calloc
+#ifndef FIB_BIG_ALLOC
+#   define FIB_BIG_ALLOC (1 << 21)
+#endif
+
+#define ALLOC_HUGE_PAGE (1 << 21)
+// mbind's MPOL_INTERLEAVE (see <numaif.h>)
+#define ALLOC_MPOL_INTERLEAVE 3
+#define ALLOC_MAX_NODES 1024
+
+// policy as set by the build, or overridden by the environment
+static int alloc_setting(char const *const name, int const fallback)
+{
+    char const *const value = getenv(name);
+    return value && *value ? atoi(value) : fallback;
+}
+
+static int alloc_pages(void)
+{
+    // -1 until read (concurrent first calls just read the same value)
+    static int pages = -1;
+    int value = __atomic_load_n(&pages, __ATOMIC_RELAXED);
+    if (value < 0)
+    {
+        value = alloc_setting("FIB_PAGES", FIB_PAGES);
+        __atomic_store_n(&pages, value, __ATOMIC_RELAXED);
+    }
+    return value;
+}
+
+static int alloc_numa(void)
+{
+    static int numa = -1;
+    int value = __atomic_load_n(&numa, __ATOMIC_RELAXED);
+    if (value < 0)
+    {
+        value = alloc_setting("FIB_NUMA", FIB_NUMA);
+        __atomic_store_n(&numa, value, __ATOMIC_RELAXED);
+    }
+    return value;
+}
+
+// whether a block of the given size is mapped (rather than calloc'd)
+static inline int alloc_mapped(size_t const bytes)
+{
+    return bytes >= FIB_BIG_ALLOC && alloc_pages() > 0;
+}
+
+// length of the mapping backing a block of the given size
+static inline size_t alloc_map_len(size_t const bytes)
+{
+    return (bytes + ALLOC_HUGE_PAGE - 1) / ALLOC_HUGE_PAGE * ALLOC_HUGE_PAGE;
+}
+
+// interleaves the pages of [addr, addr + len) over the online nodes
+// (best effort: the layout is left alone if anything fails)
+static void alloc_interleave(void *const addr, size_t const len)
+{
+    unsigned long nodes[ALLOC_MAX_NODES / (CHAR_BIT * sizeof(unsigned long))] = { 0 };
+    FILE *const online = fopen("/sys/devices/system/node/online", "r");
+    if (!online)
+    {
+        return;
+    }
+    // ranges such as "0-3,6"
+    unsigned first, last;
+    unsigned count = 0;
+    int read;
+    while ((read = fscanf(online, "%u-%u", &first, &last)) >= 1)
+    {
+        if (read == 1)
+        {
+            last = first;
+        }
+        for (unsigned node = first; node <= last && node < ALLOC_MAX_NODES; ++node, ++count)
+        {
+            nodes[node / (CHAR_BIT * sizeof(unsigned long))] |= 1ul << node % (CHAR_BIT * sizeof(unsigned long));
+        }
+        if (fgetc(online) != ',')
+        {
+            break;
+        }
+    }
+    fclose(online);
+
+    if (count > 1)
+    {
+        syscall(SYS_mbind, addr, len, ALLOC_MPOL_INTERLEAVE, nodes, ALLOC_MAX_NODES, 0ul);
+    }
+}
+
+struct alloc_touch {
+    char *bytes;
+    size_t len;
+    size_t nbands;
+};
+
+static void alloc_touch_task(void *arg, size_t const index)
+{
+    struct alloc_touch const *const job = arg;
+    size_t const begin = band_begin(job->len, job->nbands, index);
+    size_t const end = band_begin(job->len, job->nbands, index + 1);
+    memset(&job->bytes[begin], 0, end - begin);
+}
+
+// zeroed block of (at least) the given size
+static void *alloc_zeroed(size_t const bytes)
+{
+    if (!alloc_mapped(bytes))
+    {
+        return calloc(bytes, 1);
+    }
+
+    size_t const len = alloc_map_len(bytes);
+    void *block = MAP_FAILED;
+    if (alloc_pages() >= 2)
+    {
+        block = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (block == MAP_FAILED)
+    {
+        block = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (block == MAP_FAILED)
+        {
+            return NULL;
+        }
+        madvise(block, len, MADV_HUGEPAGE);
+    }
+    if (alloc_numa())
+    {
+        alloc_interleave(block, len);
+    }
+
+    if (pool_parallel())
+    {
+        // first touch from the threads that will work on the block
+        struct alloc_touch job = { .bytes = block, .len = len, .nbands = pool_size() };
+        pool_fork(alloc_touch_task, &job, job.nbands);
+    }
+    return block;
+}
+
+#ifdef FIB_THREADS
+struct alloc_on {
+    size_t bytes;
+    void *block;
+};
+
+static void alloc_on_task(void *arg, size_t const index)
+{
+    (void)index;
+    struct alloc_on *const job = arg;
+    job->block = alloc_zeroed(job->bytes);
+}
+
+// alloc_zeroed, run on the pool (from outside of it), so that a mapped block
+// is first touched by the threads of the pool rather than by the caller
+static inline void *alloc_zeroed_on(struct pool *const pool, size_t const bytes)
+{
+    struct alloc_on job = { .bytes = bytes };
+    pool_run(pool, alloc_on_task, &job, 1);
+    return job.block;
+}
+#endif
+
+// frees a block of the given size (as passed to alloc_zeroed)
+static void alloc_free(void *const block, size_t const bytes)
+{
+    if (alloc_mapped(bytes))
+    {
+        munmap(block, alloc_map_len(bytes));
+    }
+    else
+    {
+        free(block);
+    }
+}
+
+// frees a block of the given size, except for its first keep bytes,
+// which are returned in a buffer that can be passed to free()
+static inline void *alloc_keep(void *const block, size_t const bytes, size_t const keep)
+{
+    if (!alloc_mapped(bytes))
+    {
+        return realloc(block, keep);
+    }
+    void *const kept = malloc(keep);
+    memcpy(kept, block, keep);
+    munmap(block, alloc_map_len(bytes));
+    return kept;
+}
+
+#endif//ALLOC_H
@@ -0,0 +1,59 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+// Length-aware tuple buffers (to be included after mul.h).
+//
+// The matrix implementations cycle a few tuple buffers (fib, accum, scratch)
+// of nfields fields, stride digits apart, carved out of one zeroed block.
+// Each buffer remembers how many leading digits of each of its fields may be
+// nonzero (dirty); all of its other digits are zero.
+//
+// Ownership rules:
+// - every buffer belongs to exactly one role at a time, and roles trade
+//   buffers with arena_swap (which exchanges the dirty lengths along with the
+//   digits);
+// - before accumulating results into a buffer, its owner calls arena_clear
+//   with (an upper bound on) the number of digits per field that the results
+//   will touch, which zeroes those digits as well as whatever the previous
+//   contents left past them, and nothing else.
+// So a step on small operands only clears a few digits, instead of fields
+// sized for the final answer.
+
+struct arena {
+    size_t nfields;
+    size_t stride;
+};
+
+struct arena_buf {
+    DIGIT *digits;
+    // leading digits of each field that may be nonzero
+    size_t dirty;
+};
+
+// the index-th buffer of the arena laid out over block (which must be zeroed)
+static inline struct arena_buf arena_at(struct arena const *const arena, DIGIT *const block, size_t const index)
+{
+    return (struct arena_buf){ .digits = &block[index * arena->nfields * arena->stride], .dirty = 0 };
+}
+
+// zeroes the first len (<= stride) digits of each field of buf, along with
+// any dirty digits past them
+static inline DIGIT *arena_clear(struct arena const *const arena, struct arena_buf *const buf, size_t const len)
+{
+    size_t const clear = buf->dirty > len ? buf->dirty : len;
+    for (size_t field = 0; field < arena->nfields; ++field)
+    {
+        memset(&buf->digits[field * arena->stride], 0, clear * sizeof(DIGIT));
+    }
+    buf->dirty = len;
+    return buf->digits;
+}
+
+static inline void arena_swap(struct arena_buf *const lhs, struct arena_buf *const rhs)
+{
+    struct arena_buf const tmp = *lhs;
+    *lhs = *rhs;
+    *rhs = tmp;
+}
+
+#endif//ARENA_H
@@ -0,0 +1,68 @@
+#ifndef CPU_H
+#define CPU_H
+
+// Run-time selection of the instruction-set specific kernels (included by
+// mul.h, and by hex.c).
+//
+// The kernels are compiled whatever the target (with target attributes, or
+// as inline assembly), so that one binary built for a baseline x86-64 still
+// uses the widest ones the CPU supports. They are grouped in tiers:
+// - CPU_GENERIC: portable C only;
+// - CPU_AVX2: AVX2, BMI2 and ADX (the mulx/adcx/adox rows of adx.h, and the
+//   AVX2 hex encoder);
+// - CPU_AVX512: the above, plus AVX-512F and IFMA (the kernels of ifma.h).
+// The tier is detected once (cpuid, through __builtin_cpu_supports), and
+// callers branch on it; the environment variable FIB_CPU (generic, avx2 or
+// avx512) forces a lower tier, e.g. to benchmark the kernels against each
+// other on the same machine.
+
+#include <stdlib.h>
+#include <string.h>
+
+#define CPU_GENERIC 0
+#define CPU_AVX2 1
+#define CPU_AVX512 2
+
+static char const *const cpu_tier_names[] = { "generic", "avx2", "avx512" };
+
+static int cpu_detect(void)
+{
+#   if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (!(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("adx")))
+    {
+        return CPU_GENERIC;
+    }
+    if (!(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512ifma")))
+    {
+        return CPU_AVX2;
+    }
+    return CPU_AVX512;
+#   else
+    return CPU_GENERIC;
+#   endif
+}
+
+// best tier supported by the CPU (and allowed by FIB_CPU)
+static inline int cpu_tier(void)
+{
+    // -1 until detected (concurrent first calls just detect the same tier)
+    static int tier = -1;
+    int value = __atomic_load_n(&tier, __ATOMIC_RELAXED);
+    if (value < 0)
+    {
+        value = cpu_detect();
+        char const *const forced = getenv("FIB_CPU");
+        for (int t = CPU_GENERIC; forced && t < value; ++t)
+        {
+            if (strcmp(forced, cpu_tier_names[t]) == 0)
+            {
+                value = t;
+            }
+        }
+        __atomic_store_n(&tier, value, __ATOMIC_RELAXED);
+    }
+    return value;
+}
+
+#endif//CPU_H
@@ -0,0 +1,298 @@
+#ifndef FFT_H
+#define FFT_H
+
+// Floating-point FFT multiplication (included by mul.h).
+//
+// Each DIGIT is cut into FFT_PIECE_BIT-bit pieces, in balanced form (i.e. in
+// [-2^15, 2^15) for 16-bit pieces), which are the coefficients of a polynomial
+// evaluated at 2^FFT_PIECE_BIT; the product polynomial is then computed as a
+// cyclic convolution with a complex double-precision FFT.
+//
+// Two real sequences are transformed at once, as the real and imaginary parts
+// of a single complex sequence; since the transforms of real sequences are
+// Hermitian, they can be split apart (and packed together) pointwise.
+//
+// Double precision only keeps 53 bits, so the rounding error grows with the
+// transform length. Balanced pieces keep the convolution coefficients small
+// in practice, and lengths beyond FFT_MAX_LEN are refused outright; every
+// result is moreover checked a posteriori: if any coefficient is further than
+// FFT_MAX_ERROR from an integer, the product is rejected (and the caller falls
+// back to number-theoretic transforms).
+// (For adversarial inputs such as a = b = 0x7f7f...7f, the error roughly
+// doubles with the length, reaching 0.08 at 2^21 and 0.16 at 2^22 points.)
+
+// fib_base.h defines a log() macro, which clashes with <math.h>
+#pragma push_macro("log")
+#undef log
+#include <math.h>
+#pragma pop_macro("log")
+
+#define FFT_PIECE_BIT 16
+#define FFT_PIECES_PER_DIGIT (DIGIT_BIT / FFT_PIECE_BIT)
+
+#ifndef FFT_MAX_LEN
+#   define FFT_MAX_LEN ((size_t)1 << 22)
+#endif
+#ifndef FFT_MAX_ERROR
+#   define FFT_MAX_ERROR 0.125
+#endif
+
+struct cplx {
+    double re;
+    double im;
+};
+
+struct fft {
+    size_t len;
+    // roots[m + i] = exp(-pi i I / m) (for 0 <= i < m)
+    struct cplx *roots;
+};
+
+static inline struct cplx cplx_add(struct cplx const x, struct cplx const y)
+{
+    return (struct cplx){ x.re + y.re, x.im + y.im };
+}
+
+static inline struct cplx cplx_sub(struct cplx const x, struct cplx const y)
+{
+    return (struct cplx){ x.re - y.re, x.im - y.im };
+}
+
+static inline struct cplx cplx_mul(struct cplx const x, struct cplx const y)
+{
+    return (struct cplx){ x.re * y.re - x.im * y.im, x.re * y.im + x.im * y.re };
+}
+
+// smallest transform length for a product of ndigits digits
+// (one more piece per operand, for the carry out of the balanced form)
+static inline size_t fft_size(size_t const ndigits)
+{
+    size_t len = 1;
+    while (len < ndigits * FFT_PIECES_PER_DIGIT + 1)
+    {
+        len <<= 1;
+    }
+    return len;
+}
+
+// prepares the twiddle factors for transforms of length len (a power of two)
+static void fft_init(struct fft *const ctx, size_t const len)
+{
+    ctx->len = len;
+    ctx->roots = malloc((len > 1 ? len : 2) * sizeof(struct cplx));
+
+    // every root is computed directly, so that the error does not accumulate
+    for (size_t m = 1; m < len; m <<= 1)
+    {
+        for (size_t i = 0; i < m; ++i)
+        {
+            double const angle = -M_PI * (double)i / (double)m;
+            ctx->roots[m + i] = (struct cplx){ cos(angle), sin(angle) };
+        }
+    }
+}
+
+static void fft_free(struct fft *const ctx)
+{
+    free(ctx->roots);
+    ctx->roots = NULL;
+}
+
+// cuts (*a) into balanced pieces, stored in the real (offset 0) or imaginary
+// (offset 1) parts of (*z); the other part is left untouched
+static void fft_load(
+        double *const z, size_t const len, unsigned const part,
+        DIGIT const *const a, size_t const adigits)
+{
+    long carry = 0;
+    size_t piece = 0;
+    for (size_t offset = 0; offset < adigits; ++offset)
+    {
+        DIGIT digit = a[offset];
+        for (unsigned i = 0; i < FFT_PIECES_PER_DIGIT; ++i, ++piece)
+        {
+            long value = (long)(digit & ((1u << FFT_PIECE_BIT) - 1)) + carry;
+            digit >>= FFT_PIECE_BIT;
+            carry = value >= (1l << (FFT_PIECE_BIT - 1));
+            value -= carry << FFT_PIECE_BIT;
+            z[2 * piece + part] = (double)value;
+        }
+    }
+    for (; piece < len; ++piece)
+    {
+        z[2 * piece + part] = (double)carry;
+        carry = 0;
+    }
+}
+
+// in-place transform (forward: exp(-2 pi I / len), inverse: exp(2 pi I / len)),
+// from natural order to natural order; the inverse is not scaled
+static void fft_transform(struct fft const *const ctx, double *const data, int const inverse)
+{
+    size_t const len = ctx->len;
+    struct cplx *const z = (struct cplx *)data;
+
+    // bit-reversal permutation
+    for (size_t i = 1, j = 0; i < len; ++i)
+    {
+        size_t bit = len >> 1;
+        for (; j & bit; bit >>= 1)
+        {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j)
+        {
+            struct cplx const tmp = z[i];
+            z[i] = z[j];
+            z[j] = tmp;
+        }
+    }
+
+    for (size_t m = 1; m < len; m <<= 1)
+    {
+        struct cplx const *const roots = &ctx->roots[m];
+        for (size_t block = 0; block < len; block += 2 * m)
+        {
+            struct cplx *const lo = &z[block];
+            struct cplx *const hi = &z[block + m];
+            for (size_t i = 0; i < m; ++i)
+            {
+                struct cplx w = roots[i];
+                if (inverse)
+                {
+                    w.im = -w.im;
+                }
+                struct cplx const u = lo[i];
+                struct cplx const v = cplx_mul(hi[i], w);
+                lo[i] = cplx_add(u, v);
+                hi[i] = cplx_sub(u, v);
+            }
+        }
+    }
+}
+
+// given the transform of a + Ib (with a, b real), extracts the transforms of
+// a and b at index k (those at len - k are their conjugates)
+static inline void fft_split(
+        double const *const data, size_t const k, size_t const len,
+        struct cplx *const a, struct cplx *const b)
+{
+    struct cplx const *const z = (struct cplx const *)data;
+    struct cplx const zk = z[k];
+    struct cplx const zm = z[(len - k) & (len - 1)];
+    *a = (struct cplx){ 0.5 * (zk.re + zm.re), 0.5 * (zk.im - zm.im) };
+    *b = (struct cplx){ 0.5 * (zk.im + zm.im), 0.5 * (zm.re - zk.re) };
+}
+
+// given the transforms of p and q (with p, q real) at index k, writes the
+// transform of p + Iq at indices k and len - k
+static inline void fft_join(
+        double *const data, size_t const k, size_t const len,
+        struct cplx const p, struct cplx const q)
+{
+    struct cplx *const z = (struct cplx *)data;
+    z[k] = (struct cplx){ p.re - q.im, p.im + q.re };
+    z[(len - k) & (len - 1)] = (struct cplx){ p.re + q.im, q.re - p.im };
+}
+
+// rounds the real (offset 0) or imaginary (offset 1) parts of (*z), scaled
+// by 1/len, and carries them into (*result), writing exactly rdigits digits
+// returns 0 if the rounding error is too large (the result is then garbage)
+static int fft_store(
+        DIGIT *restrict result, size_t const rdigits,
+        double const *const z, size_t const len, unsigned const part)
+{
+    double const scale = 1. / (double)len;
+    double error = 0.;
+    long carry = 0;
+    size_t piece = 0;
+    for (size_t offset = 0; offset < rdigits; ++offset)
+    {
+        DIGIT digit = 0;
+        for (unsigned i = 0; i < FFT_PIECES_PER_DIGIT; ++i, ++piece)
+        {
+            if (piece < len)
+            {
+                double const value = z[2 * piece + part] * scale;
+                double const rounded = nearbyint(value);
+                error = fmax(error, fabs(value - rounded));
+                carry += (long)rounded;
+            }
+            digit |= (DIGIT)(carry & ((1l << FFT_PIECE_BIT) - 1)) << (i * FFT_PIECE_BIT);
+            carry >>= FFT_PIECE_BIT;
+        }
+        result[offset] = digit;
+    }
+    return error <= FFT_MAX_ERROR;
+}
+
+// (*result) = (*a) * (*b), writing exactly adigits + bdigits digits
+// returns 0 (leaving garbage in result) if the FFT is too imprecise
+static int fft_mul(
+        DIGIT *restrict result,
+        DIGIT const *const a, size_t const adigits,
+        DIGIT const *const b, size_t const bdigits)
+{
+    size_t const len = fft_size(adigits + bdigits);
+    if (len > FFT_MAX_LEN)
+    {
+        return 0;
+    }
+
+    struct fft ctx;
+    fft_init(&ctx, len);
+    double *const z = malloc(2 * len * sizeof(double));
+
+    fft_load(z, len, 0, a, adigits);
+    fft_load(z, len, 1, b, bdigits);
+    fft_transform(&ctx, z, 0);
+    for (size_t k = 0; k <= len / 2; ++k)
+    {
+        struct cplx ak, bk;
+        fft_split(z, k, len, &ak, &bk);
+        fft_join(z, k, len, cplx_mul(ak, bk), (struct cplx){ 0., 0. });
+    }
+    fft_transform(&ctx, z, 1);
+    int const ok = fft_store(result, adigits + bdigits, z, len, 0);
+
+    free(z);
+    fft_free(&ctx);
+    return ok;
+}
+
+// (*result) = (*a)^2, writing exactly 2 * ndigits digits
+// returns 0 (leaving garbage in result) if the FFT is too imprecise
+static int fft_sqr(
+        DIGIT *restrict result,
+        DIGIT const *const a, size_t const ndigits)
+{
+    size_t const len = fft_size(2 * ndigits);
+    if (len > FFT_MAX_LEN)
+    {
+        return 0;
+    }
+
+    struct fft ctx;
+    fft_init(&ctx, len);
+    struct cplx *const z = malloc(len * sizeof(struct cplx));
+
+    fft_load((double *)z, len, 0, a, ndigits);
+    for (size_t k = 0; k < len; ++k)
+    {
+        z[k].im = 0.;
+    }
+    fft_transform(&ctx, (double *)z, 0);
+    for (size_t k = 0; k < len; ++k)
+    {
+        z[k] = cplx_mul(z[k], z[k]);
+    }
+    fft_transform(&ctx, (double *)z, 1);
+    int const ok = fft_store(result, 2 * ndigits, (double *)z, len, 0);
+
+    free(z);
+    fft_free(&ctx);
+    return ok;
+}
+
+#endif//FFT_H
@@ -0,0 +1,223 @@
+#ifndef IFMA_H
+#define IFMA_H
+
+// AVX-512 IFMA grade-school kernels (included by mul.h).
+//
+// vpmadd52luq/vpmadd52huq multiply eight pairs of 52-bit lanes at once, and
+// add the low (resp. high) 52 bits of each 104-bit product to a 64-bit lane.
+// So the operands are split into 52-bit limbs on the way in, and the product
+// is accumulated by columns: for each block of eight columns k, the low halves
+// of the products a_i b_j (i + j = k) go to lo[k] and their high halves to
+// hi[k] (which weighs 2^52 more), both kept in registers while j runs over b.
+// Each lane takes at most 2^12 terms of less than 2^52 before it could
+// overflow, far more than the operands handed to the basecase.
+// The columns are then carried and packed back into 64-bit digits.
+//
+// The rest of the engine (and the implementations) keep their 64-bit digits:
+// the conversion is linear, and only done at the basecase boundary.
+// The kernels are compiled for AVX-512 IFMA whatever the target of the build,
+// and are used whenever cpu_tier() >= CPU_AVX512 (see cpu.h).
+// Build with DEFINES="NO_IFMA" to leave them out.
+
+#if defined(__x86_64__) && !defined(NO_IFMA)
+#   define MUL_IFMA
+#endif
+
+#ifdef MUL_IFMA
+
+#include <immintrin.h>
+
+#define IFMA_TARGET __attribute__((target("avx512f,avx512ifma")))
+
+// operands (of 64-bit digits) of up to IFMA_MAX_DIGITS digits go through IFMA
+#ifndef IFMA_MAX_DIGITS
+#   define IFMA_MAX_DIGITS 64
+#endif
+// below IFMA_THRESHOLD digits (for the shorter operand), the scalar rows win
+// (much sooner when they run on mulx/adcx/adox, see adx.h)
+#ifndef IFMA_THRESHOLD
+#   ifdef MUL_ADX
+#       define IFMA_THRESHOLD 28
+#   else
+#       define IFMA_THRESHOLD 12
+#   endif
+#endif
+
+#define IFMA_LIMB_BIT 52
+#define IFMA_MASK ((UINT64_C(1) << IFMA_LIMB_BIT) - 1)
+// number of 52-bit limbs of an n-digit number
+#define IFMA_LIMBS(n) ((64 * (n) + IFMA_LIMB_BIT - 1) / IFMA_LIMB_BIT)
+// limbs are padded with 8 zeroes on each side, so that blocks of eight
+// columns can load their lanes without bounds checks
+#define IFMA_PAD 8
+#define IFMA_COLS (2 * IFMA_LIMBS(IFMA_MAX_DIGITS) + 8)
+
+static inline int ifma_fits(size_t const adigits, size_t const bdigits)
+{
+    size_t const shorter = adigits < bdigits ? adigits : bdigits;
+    size_t const longer = adigits < bdigits ? bdigits : adigits;
+    return shorter >= IFMA_THRESHOLD && longer <= IFMA_MAX_DIGITS;
+}
+
+// splits the ndigits 64-bit digits of (*a) into IFMA_LIMBS(ndigits) 52-bit limbs
+static inline void ifma_split(
+        uint64_t *restrict limbs,
+        uint64_t const *const a, size_t const ndigits)
+{
+    size_t const nlimbs = IFMA_LIMBS(ndigits);
+    for (size_t limb = 0; limb < nlimbs; ++limb)
+    {
+        size_t const bit = limb * IFMA_LIMB_BIT;
+        size_t const digit = bit / 64;
+        unsigned const shift = bit % 64;
+        uint64_t value = a[digit] >> shift;
+        if (shift > 64 - IFMA_LIMB_BIT && digit + 1 < ndigits)
+        {
+            value |= a[digit + 1] << (64 - shift);
+        }
+        limbs[limb] = value & IFMA_MASK;
+    }
+}
+
+// zeroes the padding around the len limbs of a padded operand
+IFMA_TARGET static inline void ifma_pad(uint64_t *const padded, size_t const len)
+{
+    _mm512_storeu_si512(padded, _mm512_setzero_si512());
+    _mm512_storeu_si512(&padded[IFMA_PAD + len], _mm512_setzero_si512());
+}
+
+// carries the columns (lo[k] at 2^(52k), hi[k] at 2^(52(k+1)), for k < ncols)
+// and packs them into exactly ndigits 64-bit digits
+static inline void ifma_join(
+        uint64_t *restrict result, size_t const ndigits,
+        uint64_t const *const lo, uint64_t const *const hi, size_t const ncols)
+{
+    __uint128_t carry = 0;
+    uint64_t digit = 0;
+    unsigned nbits = 0;
+    size_t out = 0;
+    for (size_t col = 0; out < ndigits; ++col)
+    {
+        if (col < ncols)
+        {
+            carry += lo[col];
+        }
+        if (col && col <= ncols)
+        {
+            carry += hi[col - 1];
+        }
+        uint64_t const limb = (uint64_t)carry & IFMA_MASK;
+        carry >>= IFMA_LIMB_BIT;
+
+        digit |= limb << nbits;
+        nbits += IFMA_LIMB_BIT;
+        if (nbits >= 64)
+        {
+            result[out++] = digit;
+            nbits -= 64;
+            digit = nbits ? limb >> (IFMA_LIMB_BIT - nbits) : 0;
+        }
+    }
+}
+
+// columns of (*a) * (*b), for limbs a (padded, alen) and b (blen)
+IFMA_TARGET static inline void ifma_mul_columns(
+        uint64_t *restrict lo, uint64_t *restrict hi,
+        uint64_t const *const a, size_t const alen,
+        uint64_t const *const b, size_t const blen)
+{
+    size_t const ncols = alen + blen - 1;
+    for (size_t col = 0; col < ncols; col += 8)
+    {
+        __m512i acc_lo = _mm512_setzero_si512();
+        __m512i acc_hi = _mm512_setzero_si512();
+        // lanes col + l - j of a, for the j where any of them is a limb
+        size_t const first = col + 1 > alen ? col + 1 - alen : 0;
+        size_t const last = col + 8 < blen ? col + 8 : blen;
+        for (size_t j = first; j < last; ++j)
+        {
+            __m512i const lanes = _mm512_loadu_si512(&a[col - j]);
+            __m512i const scale = _mm512_set1_epi64(b[j]);
+            acc_lo = _mm512_madd52lo_epu64(acc_lo, lanes, scale);
+            acc_hi = _mm512_madd52hi_epu64(acc_hi, lanes, scale);
+        }
+        _mm512_storeu_si512(&lo[col], acc_lo);
+        _mm512_storeu_si512(&hi[col], acc_hi);
+    }
+}
+
+// columns of (*a)^2, for limbs a (padded, len)
+// only the products a_i a_j with i > j are accumulated (through lane masks),
+// then doubled, and the squares a_j^2 are added to the even columns
+IFMA_TARGET static inline void ifma_sqr_columns(
+        uint64_t *restrict lo, uint64_t *restrict hi,
+        uint64_t const *const a, size_t const len)
+{
+    size_t const ncols = 2 * len - 1;
+    for (size_t col = 0; col < ncols; col += 8)
+    {
+        __m512i acc_lo = _mm512_setzero_si512();
+        __m512i acc_hi = _mm512_setzero_si512();
+        size_t const first = col + 1 > len ? col + 1 - len : 0;
+        // lane l takes a_(col + l - j) a_j when j < col + l - j
+        size_t const last = (col + 6) / 2 + 1 < len ? (col + 6) / 2 + 1 : len;
+        for (size_t j = first; j < last; ++j)
+        {
+            __mmask8 const lanes_from = 2 * j + 1 > col ? 0xff << (2 * j + 1 - col) : 0xff;
+            __m512i const lanes = _mm512_loadu_si512(&a[col - j]);
+            __m512i const scale = _mm512_set1_epi64(a[j]);
+            acc_lo = _mm512_mask_madd52lo_epu64(acc_lo, lanes_from, lanes, scale);
+            acc_hi = _mm512_mask_madd52hi_epu64(acc_hi, lanes_from, lanes, scale);
+        }
+        _mm512_storeu_si512(&lo[col], _mm512_slli_epi64(acc_lo, 1));
+        _mm512_storeu_si512(&hi[col], _mm512_slli_epi64(acc_hi, 1));
+    }
+    for (size_t j = 0; j < len; ++j)
+    {
+        __uint128_t const square = (__uint128_t)a[j] * a[j];
+        lo[2 * j] += (uint64_t)square & IFMA_MASK;
+        hi[2 * j] += (uint64_t)(square >> IFMA_LIMB_BIT);
+    }
+}
+
+// (*result) = (*a) * (*b), writing exactly adigits + bdigits digits
+// (for operands such that ifma_fits(adigits, bdigits))
+IFMA_TARGET static void ifma_mul(
+        uint64_t *restrict result,
+        uint64_t const *const a, size_t const adigits,
+        uint64_t const *const b, size_t const bdigits)
+{
+    uint64_t alimbs[IFMA_PAD + IFMA_LIMBS(IFMA_MAX_DIGITS) + IFMA_PAD];
+    uint64_t blimbs[IFMA_LIMBS(IFMA_MAX_DIGITS)];
+    uint64_t lo[IFMA_COLS];
+    uint64_t hi[IFMA_COLS];
+
+    size_t const alen = IFMA_LIMBS(adigits);
+    size_t const blen = IFMA_LIMBS(bdigits);
+    ifma_pad(alimbs, alen);
+    ifma_split(&alimbs[IFMA_PAD], a, adigits);
+    ifma_split(blimbs, b, bdigits);
+    ifma_mul_columns(lo, hi, &alimbs[IFMA_PAD], alen, blimbs, blen);
+    ifma_join(result, adigits + bdigits, lo, hi, alen + blen - 1);
+}
+
+// (*result) = (*a)^2, writing exactly 2 * ndigits digits
+// (for operands such that ifma_fits(ndigits, ndigits))
+IFMA_TARGET static void ifma_sqr(
+        uint64_t *restrict result,
+        uint64_t const *const a, size_t const ndigits)
+{
+    uint64_t alimbs[IFMA_PAD + IFMA_LIMBS(IFMA_MAX_DIGITS) + IFMA_PAD];
+    uint64_t lo[IFMA_COLS];
+    uint64_t hi[IFMA_COLS];
+
+    size_t const len = IFMA_LIMBS(ndigits);
+    ifma_pad(alimbs, len);
+    ifma_split(&alimbs[IFMA_PAD], a, ndigits);
+    ifma_sqr_columns(lo, hi, &alimbs[IFMA_PAD], len);
+    ifma_join(result, 2 * ndigits, lo, hi, 2 * len - 1);
+}
+
+#endif//MUL_IFMA
+
+#endif//IFMA_H
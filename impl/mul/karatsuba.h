@@ -0,0 +1,190 @@
+#ifndef KARATSUBA_H
+#define KARATSUBA_H
+
+// Karatsuba multiplication (included by mul.h).
+//
+// Writing a = a0 + a1 X and b = b0 + b1 X (X = 2^(DIGIT_BIT * lo)), we have
+//     a * b = a0b0 + (a0b0 + a1b1 - (a0 - a1)(b0 - b1)) X + a1b1 X^2
+// which takes three half-sized products instead of four.
+// The middle factor is computed from |a0 - a1| and |b0 - b1| so that every
+// intermediate value stays nonnegative.
+
+// (*result) = |(*a) - (*b)|, both ndigits long
+// returns 1 if (*a) < (*b)
+static inline int abs_diff_n(
+        DIGIT *restrict result,
+        DIGIT const *const a, DIGIT const *const b,
+        size_t const ndigits)
+{
+    if (geq_n(a, b, ndigits))
+    {
+        sub_n(result, a, b, ndigits);
+        return 0;
+    }
+    sub_n(result, b, a, ndigits);
+    return 1;
+}
+
+// (*result) = |(*a) - (*b)|, where (*a) has lo digits and (*b) has hi <= lo digits
+// returns 1 if (*a) < (*b)
+static inline int abs_diff_halves(
+        DIGIT *restrict result,
+        DIGIT const *const a, DIGIT const *const b,
+        size_t const lo, size_t const hi)
+{
+    if (lo == hi)
+    {
+        return abs_diff_n(result, a, b, lo);
+    }
+
+    // lo == hi + 1: compare a against the zero-extended b
+    if (a[hi])
+    {
+        result[hi] = a[hi] - sub_n(result, a, b, hi);
+        return 0;
+    }
+    result[hi] = 0;
+    return abs_diff_n(result, a, b, hi);
+}
+
+// combines the three partial products into result[lo..2n)
+// (*z0) and (*z2) are already in place in result; (*z1) = |a0 - a1| |b0 - b1|,
+// and z1_negative indicates that (a0 - a1)(b0 - b1) < 0
+// mid is scratch space for 2*lo + 1 digits
+static inline void karatsuba_combine(
+        DIGIT *restrict result, DIGIT *restrict mid,
+        DIGIT const *restrict z1, int const z1_negative,
+        size_t const ndigits, size_t const lo, size_t const hi)
+{
+    DIGIT const *const z0 = result;
+    DIGIT const *const z2 = &result[2 * lo];
+
+    // mid = z0 + z2
+    memcpy(mid, z0, 2 * lo * sizeof(DIGIT));
+    mid[2 * lo] = 0;
+    add_accum(mid, z2, 2 * hi);
+
+    // mid -/+= z1 (the result is a0b1 + a1b0 >= 0)
+    if (z1_negative)
+    {
+        add_accum(mid, z1, 2 * lo);
+    }
+    else
+    {
+        mid[2 * lo] -= sub_n(mid, mid, z1, 2 * lo);
+    }
+
+    // a0b1 + a1b0 < 2 X^2 / X, so it fits in ndigits + 1 digits
+    add_accum(&result[lo], mid, ndigits + 1);
+}
+
+// the three subproducts, when they are spawned as tasks
+// (squares when a[i] == b[i])
+struct karatsuba_job {
+    DIGIT *result[3];
+    DIGIT const *a[3];
+    DIGIT const *b[3];
+    size_t ndigits[3];
+    DIGIT *scratch[3];
+};
+
+static void karatsuba_task(void *arg, size_t const index)
+{
+    struct karatsuba_job const *const job = arg;
+    if (job->a[index] == job->b[index])
+    {
+        sqr_n(job->result[index], job->a[index], job->ndigits[index], job->scratch[index]);
+    }
+    else
+    {
+        mul_n(job->result[index], job->a[index], job->b[index], job->ndigits[index], job->scratch[index]);
+    }
+}
+
+// runs the subproducts (of at most lo digits) in parallel
+// the first one uses next as scratch, the others get buffers of their own
+static void karatsuba_spawn(struct karatsuba_job *const job, size_t const lo, DIGIT *const next)
+{
+    size_t const scratch_len = mul_scratch_len(lo);
+    DIGIT *const scratch = malloc(2 * scratch_len * sizeof(DIGIT));
+    job->scratch[0] = next;
+    job->scratch[1] = scratch;
+    job->scratch[2] = &scratch[scratch_len];
+    pool_fork(karatsuba_task, job, 3);
+    free(scratch);
+}
+
+static void karatsuba_mul_n(
+        DIGIT *restrict result,
+        DIGIT const *const a, DIGIT const *const b,
+        size_t const ndigits, DIGIT *restrict scratch)
+{
+    size_t const hi = ndigits >> 1;
+    size_t const lo = ndigits - hi;
+
+    DIGIT *const mid = scratch;
+    DIGIT *const adiff = &mid[2 * lo + 1];
+    DIGIT *const bdiff = &adiff[lo];
+    DIGIT *const z1 = &bdiff[lo];
+    DIGIT *const next = &z1[2 * lo];
+
+    int const z1_negative
+        = abs_diff_halves(adiff, a, &a[lo], lo, hi)
+        ^ abs_diff_halves(bdiff, b, &b[lo], lo, hi);
+
+    if (ndigits >= FIB_SPAWN_THRESHOLD && pool_parallel())
+    {
+        struct karatsuba_job job = {
+            .result = { result, &result[2 * lo], z1 },
+            .a = { a, &a[lo], adiff },
+            .b = { b, &b[lo], bdiff },
+            .ndigits = { lo, hi, lo },
+        };
+        karatsuba_spawn(&job, lo, next);
+    }
+    else
+    {
+        mul_n(result, a, b, lo, next);
+        mul_n(&result[2 * lo], &a[lo], &b[lo], hi, next);
+        mul_n(z1, adiff, bdiff, lo, next);
+    }
+
+    karatsuba_combine(result, mid, z1, z1_negative, ndigits, lo, hi);
+}
+
+static void karatsuba_sqr_n(
+        DIGIT *restrict result,
+        DIGIT const *const a,
+        size_t const ndigits, DIGIT *restrict scratch)
+{
+    size_t const hi = ndigits >> 1;
+    size_t const lo = ndigits - hi;
+
+    DIGIT *const mid = scratch;
+    DIGIT *const adiff = &mid[2 * lo + 1];
+    DIGIT *const z1 = &adiff[lo];
+    DIGIT *const next = &z1[2 * lo];
+
+    abs_diff_halves(adiff, a, &a[lo], lo, hi);
+
+    if (ndigits >= FIB_SPAWN_THRESHOLD && pool_parallel())
+    {
+        struct karatsuba_job job = {
+            .result = { result, &result[2 * lo], z1 },
+            .a = { a, &a[lo], adiff },
+            .b = { a, &a[lo], adiff },
+            .ndigits = { lo, hi, lo },
+        };
+        karatsuba_spawn(&job, lo, next);
+    }
+    else
+    {
+        sqr_n(result, a, lo, next);
+        sqr_n(&result[2 * lo], &a[lo], hi, next);
+        sqr_n(z1, adiff, lo, next);
+    }
+
+    karatsuba_combine(result, mid, z1, 0, ndigits, lo, hi);
+}
+
+#endif//KARATSUBA_H
@@ -0,0 +1,429 @@
+#ifndef MUL_H
+#define MUL_H
+
+// Subquadratic multiplication engine shared by the implementations.
+//
+// This header is meant to be included *after* the implementation has defined
+// DIGIT, DBDGT and DIGIT_BIT, so that the engine works on the same limbs
+// (in particular, on 32-bit limbs in DEBUG builds).
+//
+// Conventions (mirroring the basecase kernels in impl/*.c):
+// - numbers are little-endian arrays of DIGITs;
+// - a product of an n-digit and an m-digit number is written to exactly
+//   n + m digits (leading zeroes included);
+// - routines that need temporary memory take a `scratch` buffer, which must
+//   hold at least mul_scratch_len(n) digits for operands of n digits
+//   (the transform tier allocates its own, much larger, buffers);
+// - NTT_THRESHOLD takes precedence over the other thresholds, so that products
+//   whose smaller operand has n digits never need more than
+//   mul_scratch_len(min(n, NTT_THRESHOLD)) scratch digits;
+// - when running on a pool (see pool.h), subproducts of operands of at least
+//   FIB_SPAWN_THRESHOLD digits are spawned as tasks, with scratch of their own.
+
+#ifndef KARATSUBA_THRESHOLD
+#   define KARATSUBA_THRESHOLD 32
+#endif
+#ifndef TOOM3_THRESHOLD
+#   define TOOM3_THRESHOLD 128
+#endif
+#ifndef TOOM4_THRESHOLD
+#   define TOOM4_THRESHOLD 384
+#endif
+#ifndef NTT_THRESHOLD
+#   define NTT_THRESHOLD 1024
+#endif
+
+// a DBDGT spanning two consecutive digits, which are only aligned as DIGITs
+// (casting &digits[i] to DBDGT * instead lets the compiler assume 2 * DIGIT
+// alignment, and use aligned vector loads on it)
+typedef DBDGT digit_pair __attribute__((aligned(sizeof(DIGIT)), may_alias));
+
+// number of scratch digits needed to multiply operands of (at most) n digits
+static inline size_t mul_scratch_len(size_t const n)
+{
+    // Karatsuba uses 3n + O(1) digits at each level, and halves n each time;
+    // Toom-3 and Toom-4 use about 4.7n and 4.5n, but divide n by 3 and 4;
+    // unbalanced products need another 2n digits per step of the (Euclid-like)
+    // chunking recursion, whose lengths halve every other step
+    return 16 * n + 16 * DIGIT_BIT;
+}
+
+#include "cpu.h"
+#include "adx.h"
+
+// computes (*a) + (*b), both ndigits long
+// returns the carry
+static inline DIGIT add_n(
+        DIGIT *const result,
+        DIGIT const *const a, DIGIT const *const b,
+        size_t const ndigits)
+{
+    unsigned carry = 0;
+    size_t offset = 0;
+#   ifdef MUL_ADX
+    if (sizeof(DIGIT) == sizeof(uint64_t) && ndigits >= 8 && cpu_tier() >= CPU_AVX2)
+    {
+        carry = adx_add_n((uint64_t *)result, (uint64_t const *)a, (uint64_t const *)b, ndigits);
+        offset = ndigits / 4 * 4;
+    }
+#   endif
+    for (; offset < ndigits; ++offset)
+    {
+        DIGIT tot;
+        unsigned const c1 = __builtin_add_overflow(a[offset], b[offset], &tot);
+        unsigned const c2 = __builtin_add_overflow(tot, (DIGIT)carry, &result[offset]);
+        carry = c1 | c2;
+    }
+    return carry;
+}
+
+// computes (*a) - (*b), both ndigits long
+// returns the borrow
+static inline DIGIT sub_n(
+        DIGIT *const result,
+        DIGIT const *const a, DIGIT const *const b,
+        size_t const ndigits)
+{
+    unsigned borrow = 0;
+    for (size_t offset = 0; offset < ndigits; ++offset)
+    {
+        DIGIT diff;
+        unsigned const b1 = __builtin_sub_overflow(a[offset], b[offset], &diff);
+        unsigned const b2 = __builtin_sub_overflow(diff, (DIGIT)borrow, &result[offset]);
+        borrow = b1 | b2;
+    }
+    return borrow;
+}
+
+// adds carry to (*accum), propagating it as far as necessary
+// (the caller guarantees that the result fits)
+static inline void add_carry(DIGIT *accum, DIGIT carry)
+{
+    while (carry)
+    {
+        carry = __builtin_add_overflow(*accum, carry, accum);
+        ++accum;
+    }
+}
+
+// accumulates (*src) into (*accum), propagating the carry as far as necessary
+// (the caller guarantees that the result fits)
+static inline void add_accum(
+        DIGIT *restrict accum,
+        DIGIT const *restrict src, size_t const ndigits)
+{
+    add_carry(&accum[ndigits], add_n(accum, accum, src, ndigits));
+}
+
+// returns 1 if (*a) >= (*b), both ndigits long
+static inline int geq_n(DIGIT const *const a, DIGIT const *const b, size_t ndigits)
+{
+    while (ndigits--)
+    {
+        if (a[ndigits] != b[ndigits])
+        {
+            return a[ndigits] > b[ndigits];
+        }
+    }
+    return 1;
+}
+
+// number of digits of (*a) after stripping leading zeroes (at least 1)
+static inline size_t normalised_len(DIGIT const *const a, size_t ndigits)
+{
+    while (ndigits > 1 && !a[ndigits - 1])
+    {
+        --ndigits;
+    }
+    return ndigits;
+}
+
+#include "ifma.h"
+
+// accumulates (*a) * scale in (*accum), both ndigits long
+// returns the carry digit
+static inline DIGIT addmul_1(
+        DIGIT *restrict accum,
+        DIGIT const *const a, size_t const ndigits, DIGIT const scale)
+{
+    DBDGT carry = 0;
+    size_t offset = 0;
+#   ifdef MUL_ADX
+    if (sizeof(DIGIT) == sizeof(uint64_t) && cpu_tier() >= CPU_AVX2)
+    {
+        carry = adx_addmul_1((uint64_t *)accum, (uint64_t const *)a, ndigits, scale);
+        offset = ndigits / 4 * 4;
+    }
+#   endif
+    for (; offset < ndigits; ++offset)
+    {
+        DBDGT const acc
+            = ((DBDGT)accum[offset])
+            + ((DBDGT)a[offset]) * scale
+            + carry;
+        accum[offset] = (DIGIT)acc;
+        carry = acc >> DIGIT_BIT;
+    }
+    return (DIGIT)carry;
+}
+
+// (*result) = (*a) * (*b)
+// grade-school product, writing exactly adigits + bdigits digits
+static inline void mul_basecase(
+        DIGIT *restrict result,
+        DIGIT const *const a, size_t const adigits,
+        DIGIT const *const b, size_t const bdigits)
+{
+#   ifdef MUL_IFMA
+    if (sizeof(DIGIT) == sizeof(uint64_t) && cpu_tier() >= CPU_AVX512 && ifma_fits(adigits, bdigits))
+    {
+        ifma_mul((uint64_t *)result, (uint64_t const *)a, adigits, (uint64_t const *)b, bdigits);
+        return;
+    }
+#   endif
+    memset(result, 0, adigits * sizeof(DIGIT));
+    for (size_t boffset = 0; boffset < bdigits; ++boffset)
+    {
+        result[boffset + adigits] = addmul_1(&result[boffset], a, adigits, b[boffset]);
+    }
+}
+
+// (*result) = (*a)^2, writing exactly 2 * ndigits digits
+static inline void sqr_basecase(
+        DIGIT *restrict result,
+        DIGIT const *const a, size_t const ndigits)
+{
+#   ifdef MUL_IFMA
+    if (sizeof(DIGIT) == sizeof(uint64_t) && cpu_tier() >= CPU_AVX512 && ifma_fits(ndigits, ndigits))
+    {
+        ifma_sqr((uint64_t *)result, (uint64_t const *)a, ndigits);
+        return;
+    }
+#   endif
+    mul_basecase(result, a, ndigits, a, ndigits);
+}
+
+// balanced products dispatch to the appropriate tier
+static void mul_n(
+        DIGIT *restrict result,
+        DIGIT const *const a, DIGIT const *const b,
+        size_t const ndigits, DIGIT *restrict scratch);
+static void sqr_n(
+        DIGIT *restrict result,
+        DIGIT const *const a,
+        size_t const ndigits, DIGIT *restrict scratch);
+
+#include "pool.h"
+#include "alloc.h"
+#include "karatsuba.h"
+#include "toom.h"
+#include "ntt.h"
+#ifdef USE_FFT
+#   include "fft.h"
+#endif
+
+// products past NTT_THRESHOLD digits go through transforms
+// with USE_FFT, floating-point FFTs are tried first, falling back to NTTs
+// whenever they are too imprecise (or too long)
+static inline void transform_mul(
+        DIGIT *restrict result,
+        DIGIT const *const a, size_t const adigits,
+        DIGIT const *const b, size_t const bdigits)
+{
+#   ifdef USE_FFT
+    if (fft_mul(result, a, adigits, b, bdigits))
+    {
+        return;
+    }
+#   endif
+    ntt_mul(result, a, adigits, b, bdigits);
+}
+
+static inline void transform_sqr(
+        DIGIT *restrict result,
+        DIGIT const *const a, size_t const ndigits)
+{
+#   ifdef USE_FFT
+    if (fft_sqr(result, a, ndigits))
+    {
+        return;
+    }
+#   endif
+    ntt_sqr(result, a, ndigits);
+}
+
+static void mul_n(
+        DIGIT *restrict result,
+        DIGIT const *const a, DIGIT const *const b,
+        size_t const ndigits, DIGIT *restrict scratch)
+{
+    if (ndigits >= NTT_THRESHOLD)
+    {
+        transform_mul(result, a, ndigits, b, ndigits);
+    }
+    else if (ndigits < KARATSUBA_THRESHOLD)
+    {
+        mul_basecase(result, a, ndigits, b, ndigits);
+    }
+    else if (ndigits < TOOM3_THRESHOLD)
+    {
+        karatsuba_mul_n(result, a, b, ndigits, scratch);
+    }
+    else if (ndigits < TOOM4_THRESHOLD)
+    {
+        toom3_mul_n(result, a, b, ndigits, scratch);
+    }
+    else
+    {
+        toom4_mul_n(result, a, b, ndigits, scratch);
+    }
+}
+
+static void sqr_n(
+        DIGIT *restrict result,
+        DIGIT const *const a,
+        size_t const ndigits, DIGIT *restrict scratch)
+{
+    if (ndigits >= NTT_THRESHOLD)
+    {
+        transform_sqr(result, a, ndigits);
+    }
+    else if (ndigits < KARATSUBA_THRESHOLD)
+    {
+        sqr_basecase(result, a, ndigits);
+    }
+    else if (ndigits < TOOM3_THRESHOLD)
+    {
+        karatsuba_sqr_n(result, a, ndigits, scratch);
+    }
+    else if (ndigits < TOOM4_THRESHOLD)
+    {
+        toom3_sqr_n(result, a, ndigits, scratch);
+    }
+    else
+    {
+        toom4_sqr_n(result, a, ndigits, scratch);
+    }
+}
+
+// chunk products of an unbalanced multiplication, in groups of consecutive chunks
+struct mul_chunks {
+    DIGIT const *a;
+    DIGIT const *b;
+    size_t bdigits;
+    size_t nchunks;
+    size_t ngroups;
+    // each group accumulates its products in its own slice of partial (one chunk
+    // longer than the group), and gets a product and scratch buffer of its own
+    DIGIT *partial;
+    DIGIT *scratch;
+};
+
+static void mul_chunks_task(void *arg, size_t const index)
+{
+    struct mul_chunks const *const job = arg;
+    size_t const bdigits = job->bdigits;
+    size_t const first = band_begin(job->nchunks, job->ngroups, index);
+    size_t const last = band_begin(job->nchunks, job->ngroups, index + 1);
+
+    DIGIT *const partial = &job->partial[(first + index) * bdigits];
+    DIGIT *const prod = &job->scratch[index * (2 * bdigits + mul_scratch_len(bdigits))];
+    memset(partial, 0, (last - first + 1) * bdigits * sizeof(DIGIT));
+    for (size_t chunk = first; chunk < last; ++chunk)
+    {
+        mul_n(prod, &job->a[chunk * bdigits], job->b, bdigits, &prod[2 * bdigits]);
+        add_accum(&partial[(chunk - first) * bdigits], prod, 2 * bdigits);
+    }
+}
+
+// accumulates the products of the first nchunks bdigits-sized chunks of (*a)
+// by (*b) into (*result) (which must be zeroed), spread over the pool
+static void mul_chunks_parallel(
+        DIGIT *restrict result,
+        DIGIT const *const a, DIGIT const *const b,
+        size_t const bdigits, size_t const nchunks)
+{
+    struct mul_chunks job = {
+        .a = a, .b = b, .bdigits = bdigits, .nchunks = nchunks,
+        .ngroups = nchunks < pool_size() ? nchunks : pool_size(),
+    };
+    job.partial = malloc((nchunks + job.ngroups) * bdigits * sizeof(DIGIT));
+    job.scratch = malloc(job.ngroups * (2 * bdigits + mul_scratch_len(bdigits)) * sizeof(DIGIT));
+
+    pool_fork(mul_chunks_task, &job, job.ngroups);
+
+    for (size_t group = 0; group < job.ngroups; ++group)
+    {
+        size_t const first = band_begin(nchunks, job.ngroups, group);
+        size_t const last = band_begin(nchunks, job.ngroups, group + 1);
+        add_accum(&result[first * bdigits], &job.partial[(first + group) * bdigits], (last - first + 1) * bdigits);
+    }
+
+    free(job.scratch);
+    free(job.partial);
+}
+
+// (*result) = (*a) * (*b), writing exactly adigits + bdigits digits
+// operands may have different lengths; squares are detected and specialised
+static inline void mul(
+        DIGIT *restrict result,
+        DIGIT const *a, size_t adigits,
+        DIGIT const *b, size_t bdigits,
+        DIGIT *restrict scratch)
+{
+    if (a == b && adigits == bdigits)
+    {
+        sqr_n(result, a, adigits, scratch);
+        return;
+    }
+    if (adigits < bdigits)
+    {
+        DIGIT const *const tmp = a;
+        a = b;
+        b = tmp;
+        size_t const tmplen = adigits;
+        adigits = bdigits;
+        bdigits = tmplen;
+    }
+    if (adigits == bdigits)
+    {
+        mul_n(result, a, b, adigits, scratch);
+        return;
+    }
+    if (bdigits < KARATSUBA_THRESHOLD)
+    {
+        mul_basecase(result, a, adigits, b, bdigits);
+        return;
+    }
+    if (bdigits >= NTT_THRESHOLD)
+    {
+        // transforms do not care about the balance of the operands
+        transform_mul(result, a, adigits, b, bdigits);
+        return;
+    }
+
+    // unbalanced: cut a into bdigits-sized chunks and accumulate the products
+    DIGIT *const prod = scratch;
+    scratch += 2 * bdigits;
+
+    memset(result, 0, (adigits + bdigits) * sizeof(DIGIT));
+    size_t offset = 0;
+    if (adigits >= FIB_SPAWN_THRESHOLD && adigits >= 2 * bdigits && pool_parallel())
+    {
+        mul_chunks_parallel(result, a, b, bdigits, adigits / bdigits);
+        offset = adigits / bdigits * bdigits;
+    }
+    for (; offset + bdigits <= adigits; offset += bdigits)
+    {
+        mul_n(prod, &a[offset], b, bdigits, scratch);
+        add_accum(&result[offset], prod, 2 * bdigits);
+    }
+    if (offset < adigits)
+    {
+        size_t const rest = adigits - offset;
+        mul(prod, b, bdigits, &a[offset], rest, scratch);
+        add_accum(&result[offset], prod, bdigits + rest);
+    }
+}
+
+#endif//MUL_H
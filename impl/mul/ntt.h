@@ -0,0 +1,796 @@
+#ifndef NTT_H
+#define NTT_H
+
+// Number-theoretic transform multiplication (included by mul.h).
+//
+// Each DIGIT is a coefficient of a polynomial evaluated at X = 2^DIGIT_BIT,
+// and the product polynomial is computed as a cyclic convolution, modulo
+// three primes p < 2^62 of the form c 2^40 + 1.
+// Since each coefficient of the product is less than len * 2^(2 DIGIT_BIT),
+// and p1 p2 p3 > 2^185, the exact coefficients are recovered by the Chinese
+// remainder theorem (Garner's algorithm) for transform lengths up to 2^40,
+// with room to spare for sums of a few products.
+//
+// Arithmetic mod p is done in Montgomery form (R = 2^64): twiddle factors are
+// stored as wR mod p, so that multiplying by them is exact; pointwise products
+// of transforms pick up a factor R^-1, which ntt_inverse compensates.
+//
+// The transforms work on NTT_NPRIMES * len residues, laid out prime by prime,
+// and are left in bit-reversed order (the forward transform is decimation in
+// frequency, the inverse decimation in time).
+
+#define NTT_NPRIMES 3
+
+struct ntt_prime {
+    uint64_t p;
+    uint64_t root; // generator of the multiplicative group
+    uint64_t pinv; // -p^-1 mod 2^64
+    uint64_t r1;   // R mod p
+    uint64_t r2;   // R^2 mod p
+};
+
+static struct ntt_prime const ntt_primes[NTT_NPRIMES] = {
+    { .p = 0x3fffc00000000001, .root = 11, .pinv = 0x3fffbfffffffffff, .r1 = 0x0000fffffffffffc, .r2 = 0x3ff8bffbfffc000d },
+    { .p = 0x3fffbe0000000001, .root = 3, .pinv = 0x3fffbdffffffffff, .r1 = 0x000107fffffffffc, .r2 = 0x2180d7fbbefb9d04 },
+    { .p = 0x3fff840000000001, .root = 19, .pinv = 0x3fff83ffffffffff, .r1 = 0x0001effffffffffc, .r2 = 0x178c9ff0fbe2e818 },
+};
+
+struct ntt {
+    size_t len;
+    // for each prime (stride apart), roots[m + i] = w_2m^i R mod p
+    // (for 0 <= i < m < stride)
+    // since w_2m does not depend on the transform length, tables built for
+    // stride points serve every len <= stride (see ntt_reserve)
+    size_t stride;
+    uint64_t *roots;
+    // scratch of ntt_pair: two transforms (modulo a single prime) of up to
+    // stride points, and the residues kept from one prime to the next (see
+    // ntt_scratch_len), kept by ntt_reserve for callers running transforms
+    // step after step (NULL after a plain ntt_init)
+    uint64_t *scratch;
+    size_t scratch_len;
+};
+
+// With 64-bit digits, the residues of the results of ntt_pair modulo the first
+// prime are kept in the results themselves, which Garner's algorithm then
+// overwrites digit by digit; shorter digits leave no room for them.
+#define NTT_KEEP_IN_RESULT (sizeof(DIGIT) == sizeof(uint64_t))
+
+// words (uint64_t) of the scratch of ntt_pair, for transforms of len points
+// and results of rdigits digits in all
+static inline size_t ntt_scratch_len(size_t const len, size_t const rdigits)
+{
+    return 2 * len + (NTT_KEEP_IN_RESULT ? 1 : 2) * rdigits;
+}
+
+// a * b * R^-1 mod p, for a, b < p
+static inline uint64_t ntt_mulmod(uint64_t const a, uint64_t const b, struct ntt_prime const *const prime)
+{
+    __uint128_t const prod = (__uint128_t)a * b;
+    uint64_t const m = (uint64_t)prod * prime->pinv;
+    uint64_t const res = (prod + (__uint128_t)m * prime->p) >> 64;
+    return res >= prime->p ? res - prime->p : res;
+}
+
+static inline uint64_t ntt_addmod(uint64_t const a, uint64_t const b, struct ntt_prime const *const prime)
+{
+    uint64_t const res = a + b;
+    return res >= prime->p ? res - prime->p : res;
+}
+
+static inline uint64_t ntt_submod(uint64_t const a, uint64_t const b, struct ntt_prime const *const prime)
+{
+    return a >= b ? a - b : a + prime->p - b;
+}
+
+// base^exponent R mod p (base in Montgomery form)
+static uint64_t ntt_powmod(uint64_t base, uint64_t exponent, struct ntt_prime const *const prime)
+{
+    uint64_t res = prime->r1;
+    for (; exponent; exponent >>= 1)
+    {
+        if (exponent & 1)
+        {
+            res = ntt_mulmod(res, base, prime);
+        }
+        base = ntt_mulmod(base, base, prime);
+    }
+    return res;
+}
+
+// smallest supported transform length for a product of ndigits digits
+static inline size_t ntt_size(size_t const ndigits)
+{
+    size_t len = 1;
+    while (len < ndigits)
+    {
+        len <<= 1;
+    }
+    return len;
+}
+
+// Loops over the points of long transforms (and the butterflies of their
+// blocks, recursively) are cut into tasks when running on a pool (see pool.h);
+// every task works on its own points, so that the results do not depend on
+// the number of threads.
+
+// arguments of the tasks below (each of which uses a subset)
+struct ntt_job {
+    struct ntt const *ctx;
+    struct ntt_prime const *prime;
+    uint64_t const *roots;
+    uint64_t *t;
+    uint64_t const *x;
+    uint64_t const *y;
+    size_t len;
+    size_t nchunks;
+    uint64_t scale;
+
+    DIGIT const *a;
+    size_t adigits;
+    DIGIT *result;
+    size_t rdigits;
+    uint64_t (*carries)[3];
+};
+
+// number of tasks to cut a loop over len points into
+static inline size_t ntt_chunks(size_t const len)
+{
+    if (!pool_parallel() || len < 2 * FIB_SPAWN_THRESHOLD)
+    {
+        return 1;
+    }
+    size_t const most = len / FIB_SPAWN_THRESHOLD;
+    return most < pool_size() ? most : pool_size();
+}
+
+// runs task(job, j) for each prime (in parallel for transforms of len points)
+static void ntt_each_prime(pool_task *const task, struct ntt_job *const job, size_t const len)
+{
+    if (ntt_chunks(len) > 1)
+    {
+        pool_fork(task, job, NTT_NPRIMES);
+        return;
+    }
+    for (unsigned j = 0; j < NTT_NPRIMES; ++j)
+    {
+        task(job, j);
+    }
+}
+
+// twiddle factors modulo the jth prime
+static void ntt_init_task(void *arg, size_t const j)
+{
+    struct ntt_job const *const job = arg;
+    size_t const len = job->ctx->stride;
+    struct ntt_prime const *const prime = &ntt_primes[j];
+    uint64_t *const roots = &job->ctx->roots[j * len];
+    if (len < 2)
+    {
+        return;
+    }
+
+    // top level: powers of a primitive len-th root of unity
+    size_t const half = len >> 1;
+    uint64_t const generator = ntt_mulmod(prime->root, prime->r2, prime);
+    uint64_t const w = ntt_powmod(generator, (prime->p - 1) / len, prime);
+    roots[half] = prime->r1;
+    for (size_t i = 1; i < half; ++i)
+    {
+        roots[half + i] = ntt_mulmod(roots[half + i - 1], w, prime);
+    }
+    // lower levels: w_m = w_2m^2
+    for (size_t m = half >> 1; m; m >>= 1)
+    {
+        for (size_t i = 0; i < m; ++i)
+        {
+            roots[m + i] = roots[2 * m + 2 * i];
+        }
+    }
+}
+
+// prepares the twiddle factors for transforms of length len (a power of two)
+static void ntt_init(struct ntt *const ctx, size_t const len)
+{
+    ctx->len = len;
+    ctx->stride = len;
+    ctx->roots = alloc_zeroed(NTT_NPRIMES * len * sizeof(uint64_t));
+    ctx->scratch = NULL;
+    ctx->scratch_len = 0;
+
+    struct ntt_job job = { .ctx = ctx };
+    ntt_each_prime(ntt_init_task, &job, len);
+}
+
+static void ntt_free(struct ntt *const ctx)
+{
+    alloc_free(ctx->roots, NTT_NPRIMES * ctx->stride * sizeof(uint64_t));
+    if (ctx->scratch)
+    {
+        alloc_free(ctx->scratch, ctx->scratch_len * sizeof(uint64_t));
+    }
+    ctx->roots = NULL;
+    ctx->scratch = NULL;
+    ctx->stride = 0;
+    ctx->scratch_len = 0;
+}
+
+// prepares ctx (zero-initialised, or left by previous calls) for transforms of
+// length len, with the scratch of ntt_pair for results of rdigits digits in all;
+// its twiddle factors and scratch are only rebuilt when they are shorter than
+// that
+// callers running transforms step after step keep ctx around, and ntt_free it
+// once done
+static inline void ntt_reserve(struct ntt *const ctx, size_t const len, size_t const rdigits)
+{
+    size_t const scratch_len = ntt_scratch_len(len, rdigits);
+    if (ctx->stride < len || ctx->scratch_len < scratch_len)
+    {
+        size_t const stride = ctx->stride < len ? len : ctx->stride;
+        ntt_free(ctx);
+        ntt_init(ctx, stride);
+        ctx->scratch = alloc_zeroed(scratch_len * sizeof(uint64_t));
+        ctx->scratch_len = scratch_len;
+    }
+    ctx->len = len;
+}
+
+// forward (decimation in frequency) butterflies between the halves of the block
+// t[0..2m), at points [begin, end) of each half
+static inline void ntt_dif_butterflies(
+        uint64_t *restrict const t, size_t const m, size_t const begin, size_t const end,
+        uint64_t const *const roots, struct ntt_prime const *const prime)
+{
+    uint64_t *const lo = t;
+    uint64_t *const hi = &t[m];
+    for (size_t i = begin; i < end; ++i)
+    {
+        uint64_t const u = lo[i];
+        uint64_t const v = hi[i];
+        lo[i] = ntt_addmod(u, v, prime);
+        hi[i] = ntt_mulmod(ntt_submod(u, v, prime), roots[m + i], prime);
+    }
+}
+
+// inverse (decimation in time) butterflies between the halves of the block
+// t[0..2m), at points [begin, end) of each half
+static inline void ntt_dit_butterflies(
+        uint64_t *restrict const t, size_t const m, size_t begin, size_t const end,
+        uint64_t const *const roots, struct ntt_prime const *const prime)
+{
+    uint64_t *const lo = t;
+    uint64_t *const hi = &t[m];
+    if (!begin)
+    {
+        uint64_t const u0 = lo[0];
+        uint64_t const v0 = hi[0];
+        lo[0] = ntt_addmod(u0, v0, prime);
+        hi[0] = ntt_submod(u0, v0, prime);
+        begin = 1;
+    }
+    // w_2m^-i = -w_2m^(m-i)
+    for (size_t i = begin; i < end; ++i)
+    {
+        uint64_t const u = lo[i];
+        uint64_t const v = ntt_mulmod(hi[i], roots[2 * m - i], prime);
+        lo[i] = ntt_submod(u, v, prime);
+        hi[i] = ntt_addmod(u, v, prime);
+    }
+}
+
+static void ntt_dif(uint64_t *t, size_t len, uint64_t const *roots, struct ntt_prime const *prime);
+static void ntt_dit(uint64_t *t, size_t len, uint64_t const *roots, struct ntt_prime const *prime);
+
+// top-level butterflies of a block, over a chunk of points
+static void ntt_dif_level_task(void *arg, size_t const index)
+{
+    struct ntt_job const *const job = arg;
+    size_t const m = job->len >> 1;
+    ntt_dif_butterflies(job->t, m,
+            band_begin(m, job->nchunks, index), band_begin(m, job->nchunks, index + 1),
+            job->roots, job->prime);
+}
+
+static void ntt_dit_level_task(void *arg, size_t const index)
+{
+    struct ntt_job const *const job = arg;
+    size_t const m = job->len >> 1;
+    ntt_dit_butterflies(job->t, m,
+            band_begin(m, job->nchunks, index), band_begin(m, job->nchunks, index + 1),
+            job->roots, job->prime);
+}
+
+// the rest of the transform of a block, on either half
+static void ntt_dif_half_task(void *arg, size_t const index)
+{
+    struct ntt_job const *const job = arg;
+    size_t const m = job->len >> 1;
+    ntt_dif(&job->t[index * m], m, job->roots, job->prime);
+}
+
+static void ntt_dit_half_task(void *arg, size_t const index)
+{
+    struct ntt_job const *const job = arg;
+    size_t const m = job->len >> 1;
+    ntt_dit(&job->t[index * m], m, job->roots, job->prime);
+}
+
+// forward transform of the block t[0..len), from the top level down
+static void ntt_dif(
+        uint64_t *const t, size_t const len,
+        uint64_t const *const roots, struct ntt_prime const *const prime)
+{
+    size_t const nchunks = ntt_chunks(len);
+    if (nchunks > 1)
+    {
+        struct ntt_job job = { .prime = prime, .roots = roots, .t = t, .len = len, .nchunks = nchunks };
+        pool_fork(ntt_dif_level_task, &job, nchunks);
+        pool_fork(ntt_dif_half_task, &job, 2);
+        return;
+    }
+
+    for (size_t m = len >> 1; m; m >>= 1)
+    {
+        for (size_t block = 0; block < len; block += 2 * m)
+        {
+            ntt_dif_butterflies(&t[block], m, 0, m, roots, prime);
+        }
+    }
+}
+
+// inverse transform of the block t[0..len), from the bottom level up
+static void ntt_dit(
+        uint64_t *const t, size_t const len,
+        uint64_t const *const roots, struct ntt_prime const *const prime)
+{
+    size_t const nchunks = ntt_chunks(len);
+    if (nchunks > 1)
+    {
+        struct ntt_job job = { .prime = prime, .roots = roots, .t = t, .len = len, .nchunks = nchunks };
+        pool_fork(ntt_dit_half_task, &job, 2);
+        pool_fork(ntt_dit_level_task, &job, nchunks);
+        return;
+    }
+
+    for (size_t m = 1; m < len; m <<= 1)
+    {
+        for (size_t block = 0; block < len; block += 2 * m)
+        {
+            ntt_dit_butterflies(&t[block], m, 0, m, roots, prime);
+        }
+    }
+}
+
+// t[i] = a[i] mod p (zero-padded past adigits), over a chunk of points
+static void ntt_load_task(void *arg, size_t const index)
+{
+    struct ntt_job const *const job = arg;
+    uint64_t *restrict const t = job->t;
+    DIGIT const *const a = job->a;
+    uint64_t const p = job->prime->p;
+    size_t const begin = band_begin(job->len, job->nchunks, index);
+    size_t const end = band_begin(job->len, job->nchunks, index + 1);
+    size_t const split = job->adigits < begin ? begin : job->adigits < end ? job->adigits : end;
+
+    for (size_t i = begin; i < split; ++i)
+    {
+        t[i] = a[i] % p;
+    }
+    memset(&t[split], 0, (end - split) * sizeof(uint64_t));
+}
+
+// (*t) = transform of (*a) (adigits digits, zero-padded) modulo the jth prime
+static void ntt_forward_prime(
+        struct ntt const *const ctx, uint64_t *restrict t,
+        DIGIT const *const a, size_t const adigits, unsigned const j)
+{
+    size_t const len = ctx->len;
+    struct ntt_prime const *const prime = &ntt_primes[j];
+    uint64_t const *const roots = &ctx->roots[j * ctx->stride];
+
+    struct ntt_job job = {
+        .prime = prime, .t = t, .len = len, .nchunks = ntt_chunks(len),
+        .a = a, .adigits = adigits,
+    };
+    pool_fork(ntt_load_task, &job, job.nchunks);
+    ntt_dif(t, len, roots, prime);
+}
+
+static void ntt_forward_task(void *arg, size_t const j)
+{
+    struct ntt_job const *const job = arg;
+    ntt_forward_prime(job->ctx, &job->t[j * job->ctx->len], job->a, job->adigits, j);
+}
+
+// (*t) = transforms of (*a) (adigits digits, zero-padded) modulo each prime
+static void ntt_forward(
+        struct ntt const *const ctx, uint64_t *restrict t,
+        DIGIT const *const a, size_t const adigits)
+{
+    struct ntt_job job = { .ctx = ctx, .t = t, .a = a, .adigits = adigits };
+    ntt_each_prime(ntt_forward_task, &job, ctx->len);
+}
+
+// pointwise products, over a chunk of the points of a prime
+static void ntt_pointwise_task(void *arg, size_t const index)
+{
+    struct ntt_job const *const job = arg;
+    size_t const j = index / job->nchunks;
+    size_t const chunk = index % job->nchunks;
+    struct ntt_prime const *const prime = &ntt_primes[j];
+    uint64_t *const t = &job->t[j * job->len];
+    uint64_t const *const x = &job->x[j * job->len];
+    uint64_t const *const y = &job->y[j * job->len];
+
+    size_t const end = band_begin(job->len, job->nchunks, chunk + 1);
+    for (size_t i = band_begin(job->len, job->nchunks, chunk); i < end; ++i)
+    {
+        t[i] = ntt_mulmod(x[i], y[i], prime);
+    }
+}
+
+// (*t) = pointwise (*x) * (*y), for transforms of the same length
+static void ntt_pointwise_mul(
+        struct ntt const *const ctx, uint64_t *const t,
+        uint64_t const *const x, uint64_t const *const y)
+{
+    struct ntt_job job = { .t = t, .x = x, .y = y, .len = ctx->len, .nchunks = ntt_chunks(ctx->len) };
+    pool_fork(ntt_pointwise_task, &job, NTT_NPRIMES * job.nchunks);
+}
+
+// t[i] *= scale, over a chunk of points
+static void ntt_scale_task(void *arg, size_t const index)
+{
+    struct ntt_job const *const job = arg;
+    uint64_t *restrict const t = job->t;
+    uint64_t const scale = job->scale;
+    struct ntt_prime const *const prime = job->prime;
+
+    size_t const end = band_begin(job->len, job->nchunks, index + 1);
+    for (size_t i = band_begin(job->len, job->nchunks, index); i < end; ++i)
+    {
+        t[i] = ntt_mulmod(t[i], scale, prime);
+    }
+}
+
+// inverse transform (in place) modulo the jth prime, scaled to undo both 1/len
+// and the R^-1 introduced by the pointwise products
+static void ntt_inverse_prime(struct ntt const *const ctx, uint64_t *const t, unsigned const j)
+{
+    size_t const len = ctx->len;
+    struct ntt_prime const *const prime = &ntt_primes[j];
+    uint64_t const *const roots = &ctx->roots[j * ctx->stride];
+
+    ntt_dit(t, len, roots, prime);
+
+    // len^-1 R^2 mod p (len^-1 = (p - 1) / len * -1, as len divides p - 1)
+    uint64_t const len_inverse = prime->p - (prime->p - 1) / len;
+    struct ntt_job job = {
+        .prime = prime, .t = t, .len = len, .nchunks = ntt_chunks(len),
+        .scale = ntt_mulmod(ntt_mulmod(len_inverse, prime->r2, prime), prime->r2, prime),
+    };
+    pool_fork(ntt_scale_task, &job, job.nchunks);
+}
+
+static void ntt_inverse_task(void *arg, size_t const j)
+{
+    struct ntt_job const *const job = arg;
+    ntt_inverse_prime(job->ctx, &job->t[j * job->ctx->len], j);
+}
+
+// inverse transforms (in place), modulo each prime
+static void ntt_inverse(struct ntt const *const ctx, uint64_t *const t)
+{
+    struct ntt_job job = { .ctx = ctx, .t = t };
+    ntt_each_prime(ntt_inverse_task, &job, ctx->len);
+}
+
+// writes digits [begin, end) of the sum of the coefficients times X^i, where
+// the ith coefficient has residues (r1[i], r2[i], r3[i]) modulo the primes
+// (for i < ncoefs, and is 0 past that), as if nothing carried into digit begin
+// the carry out of digit end - 1 is left in carry[0..3)
+// r1 may be the result itself (digit i is written once r1[i] is read)
+static void ntt_garner_range(
+        DIGIT *const result, size_t const begin, size_t const end,
+        uint64_t const *const r1s, uint64_t const *restrict const r2s,
+        uint64_t const *restrict const r3s, size_t const ncoefs,
+        uint64_t carry[3])
+{
+    struct ntt_prime const *const p1 = &ntt_primes[0];
+    struct ntt_prime const *const p2 = &ntt_primes[1];
+    struct ntt_prime const *const p3 = &ntt_primes[2];
+
+    // Garner's constants, in Montgomery form
+    uint64_t const p1_mod_p3 = ntt_mulmod(p1->p % p3->p, p3->r2, p3);
+    uint64_t const p1_inv_p2 = ntt_powmod(ntt_mulmod(p1->p % p2->p, p2->r2, p2), p2->p - 2, p2);
+    uint64_t const p12_inv_p3 = ntt_powmod(
+            ntt_mulmod(ntt_mulmod(p1->p % p3->p, p3->r2, p3), ntt_mulmod(p2->p % p3->p, p3->r2, p3), p3),
+            p3->p - 2, p3);
+    __uint128_t const p12 = (__uint128_t)p1->p * p2->p;
+
+    // 192-bit carry
+    uint64_t c0 = 0, c1 = 0, c2 = 0;
+    for (size_t i = begin; i < end; ++i)
+    {
+        if (i < ncoefs)
+        {
+            uint64_t const r1 = r1s[i];
+            uint64_t const r2 = r2s[i];
+            uint64_t const r3 = r3s[i];
+
+            // x = v1 + v2 p1 + v3 p1 p2
+            uint64_t const v1 = r1;
+            uint64_t const v2 = ntt_mulmod(ntt_submod(r2, v1 % p2->p, p2), p1_inv_p2, p2);
+            uint64_t const v12 = ntt_addmod(v1 % p3->p, ntt_mulmod(v2, p1_mod_p3, p3), p3);
+            uint64_t const v3 = ntt_mulmod(ntt_submod(r3, v12, p3), p12_inv_p3, p3);
+
+            __uint128_t const low = (__uint128_t)v2 * p1->p + v1;
+            __uint128_t const top_lo = (__uint128_t)v3 * (uint64_t)p12;
+            __uint128_t const top_hi = (__uint128_t)v3 * (uint64_t)(p12 >> 64);
+
+            // (c0, c1, c2) += low + top_lo + (top_hi << 64)
+            __uint128_t acc = (__uint128_t)c0 + (uint64_t)low + (uint64_t)top_lo;
+            c0 = (uint64_t)acc;
+            acc = (acc >> 64) + c1 + (uint64_t)(low >> 64) + (uint64_t)(top_lo >> 64) + (uint64_t)top_hi;
+            c1 = (uint64_t)acc;
+            c2 += (uint64_t)(acc >> 64) + (uint64_t)(top_hi >> 64);
+        }
+
+        // emit a digit, and shift the carry by DIGIT_BIT (which is 32 or 64)
+        result[i] = (DIGIT)c0;
+        c0 = (c0 >> (DIGIT_BIT - 1) >> 1) | (c1 << (64 - DIGIT_BIT));
+        c1 = (c1 >> (DIGIT_BIT - 1) >> 1) | (c2 << (64 - DIGIT_BIT));
+        c2 = c2 >> (DIGIT_BIT - 1) >> 1;
+    }
+    carry[0] = c0;
+    carry[1] = c1;
+    carry[2] = c2;
+}
+
+// writes digits [begin, end) of the sum of the coefficients in (*t) (inverse
+// transformed) times X^i, as if nothing carried into digit begin
+// the carry out of digit end - 1 is left in carry[0..3)
+static inline void ntt_crt_range(
+        DIGIT *restrict result, size_t const begin, size_t const end,
+        uint64_t const *restrict t, size_t const len, uint64_t carry[3])
+{
+    ntt_garner_range(result, begin, end, t, &t[len], &t[2 * len], len, carry);
+}
+
+// adds a carry left by ntt_crt_range to result[offset..rdigits)
+static inline void ntt_crt_carry(
+        DIGIT *const result, size_t offset, size_t const rdigits,
+        uint64_t const carry[3])
+{
+    uint64_t c0 = carry[0], c1 = carry[1], c2 = carry[2];
+    unsigned overflow = 0;
+    for (; offset < rdigits && (c0 | c1 | c2 | overflow); ++offset)
+    {
+        unsigned const o1 = __builtin_add_overflow(result[offset], (DIGIT)c0, &result[offset]);
+        unsigned const o2 = __builtin_add_overflow(result[offset], (DIGIT)overflow, &result[offset]);
+        overflow = o1 | o2;
+        c0 = (c0 >> (DIGIT_BIT - 1) >> 1) | (c1 << (64 - DIGIT_BIT));
+        c1 = (c1 >> (DIGIT_BIT - 1) >> 1) | (c2 << (64 - DIGIT_BIT));
+        c2 = c2 >> (DIGIT_BIT - 1) >> 1;
+    }
+}
+
+// Chinese remainders over a band of digits
+static void ntt_crt_task(void *arg, size_t const index)
+{
+    struct ntt_job const *const job = arg;
+    ntt_crt_range(job->result,
+            band_begin(job->rdigits, job->nchunks, index),
+            band_begin(job->rdigits, job->nchunks, index + 1),
+            job->x, job->len, job->carries[index]);
+}
+
+// (*result) = sum of the coefficients in (*t) (inverse transformed) times X^i,
+// writing exactly rdigits digits
+static void ntt_crt(
+        DIGIT *restrict result, size_t const rdigits,
+        uint64_t const *restrict t, size_t const len)
+{
+    size_t const nchunks = ntt_chunks(rdigits);
+    if (nchunks == 1)
+    {
+        uint64_t carry[3];
+        ntt_crt_range(result, 0, rdigits, t, len, carry);
+        return;
+    }
+
+    struct ntt_job job = {
+        .x = t, .len = len, .nchunks = nchunks,
+        .result = result, .rdigits = rdigits,
+        .carries = malloc(nchunks * sizeof(uint64_t[3])),
+    };
+    pool_fork(ntt_crt_task, &job, nchunks);
+
+    // propagate the carries out of the bands, in order
+    for (size_t i = 0; i + 1 < nchunks; ++i)
+    {
+        ntt_crt_carry(result, band_begin(rdigits, nchunks, i + 1), rdigits, job.carries[i]);
+    }
+    free(job.carries);
+}
+
+// pointwise step of ntt_pair: replaces the transforms (x, y) of its operands
+// modulo prime with those of its two results, at points [begin, end)
+typedef void ntt_pair_op(
+        uint64_t *restrict x, uint64_t *restrict y,
+        size_t begin, size_t end, struct ntt_prime const *prime);
+
+// arguments of the tasks of ntt_pair (each of which works on either result,
+// or on a chunk of points)
+struct ntt_pair_job {
+    struct ntt const *ctx;
+    ntt_pair_op *op;
+    unsigned j;
+    size_t nchunks;
+
+    DIGIT const *in[2];
+    size_t indigits[2];
+    // transforms modulo the jth prime
+    uint64_t *t[2];
+    // residues of the results modulo the first two primes (ncoefs of each)
+    uint64_t *keep[2][2];
+    size_t ncoefs[2];
+
+    DIGIT *out[2];
+    size_t outdigits[2];
+    size_t nbands;
+    uint64_t (*carries)[3];
+};
+
+static void ntt_pair_forward_task(void *arg, size_t const k)
+{
+    struct ntt_pair_job const *const job = arg;
+    ntt_forward_prime(job->ctx, job->t[k], job->in[k], job->indigits[k], job->j);
+}
+
+static void ntt_pair_op_task(void *arg, size_t const index)
+{
+    struct ntt_pair_job const *const job = arg;
+    size_t const len = job->ctx->len;
+    job->op(job->t[0], job->t[1],
+            band_begin(len, job->nchunks, index), band_begin(len, job->nchunks, index + 1),
+            &ntt_primes[job->j]);
+}
+
+static void ntt_pair_inverse_task(void *arg, size_t const k)
+{
+    struct ntt_pair_job const *const job = arg;
+    ntt_inverse_prime(job->ctx, job->t[k], job->j);
+}
+
+static void ntt_pair_keep_task(void *arg, size_t const k)
+{
+    struct ntt_pair_job const *const job = arg;
+    memcpy(job->keep[job->j][k], job->t[k], job->ncoefs[k] * sizeof(uint64_t));
+}
+
+// Chinese remainders over a band of digits of either result
+static void ntt_pair_crt_task(void *arg, size_t const index)
+{
+    struct ntt_pair_job const *const job = arg;
+    size_t const k = index / job->nbands;
+    size_t const band = index % job->nbands;
+    ntt_garner_range(job->out[k],
+            band_begin(job->outdigits[k], job->nbands, band),
+            band_begin(job->outdigits[k], job->nbands, band + 1),
+            job->keep[0][k], job->keep[1][k], job->t[k], job->ncoefs[k], job->carries[index]);
+}
+
+// (*out1, *out2) = the two results formed by op from the transforms of (*a, *b),
+// writing exactly out1digits and out2digits digits (which must fit them)
+// ctx must have been prepared by ntt_reserve, for out1digits + out2digits
+// digits; the transforms then run one prime at a time, and only the residues
+// of the digits of the results are kept from one prime to the next, so that
+// the working memory is two transforms rather than six
+// the results may not overlap the operands
+static inline void ntt_pair(
+        struct ntt const *const ctx,
+        DIGIT *const out1, size_t const out1digits,
+        DIGIT *const out2, size_t const out2digits,
+        DIGIT const *const a, size_t const adigits,
+        DIGIT const *const b, size_t const bdigits,
+        ntt_pair_op *const op)
+{
+    size_t const len = ctx->len;
+    struct ntt_pair_job job = {
+        .ctx = ctx, .op = op, .nchunks = ntt_chunks(len),
+        .in = { a, b }, .indigits = { adigits, bdigits },
+        .t = { ctx->scratch, &ctx->scratch[len] },
+        // (the coefficients past the digits of the results are all 0)
+        .ncoefs = { out1digits < len ? out1digits : len, out2digits < len ? out2digits : len },
+        .out = { out1, out2 }, .outdigits = { out1digits, out2digits },
+    };
+    uint64_t *kept = &ctx->scratch[2 * len];
+    for (unsigned j = 0; j < 2; ++j)
+    {
+        for (unsigned k = 0; k < 2; ++k)
+        {
+            if (!j && NTT_KEEP_IN_RESULT)
+            {
+                job.keep[j][k] = (uint64_t *)job.out[k];
+            }
+            else
+            {
+                job.keep[j][k] = kept;
+                kept += job.ncoefs[k];
+            }
+        }
+    }
+
+    for (job.j = 0; job.j < NTT_NPRIMES; ++job.j)
+    {
+        pool_fork(ntt_pair_forward_task, &job, 2);
+        pool_fork(ntt_pair_op_task, &job, job.nchunks);
+        pool_fork(ntt_pair_inverse_task, &job, 2);
+        if (job.j + 1 < NTT_NPRIMES)
+        {
+            pool_fork(ntt_pair_keep_task, &job, 2);
+        }
+    }
+
+    // Garner's algorithm, from the residues kept and those left in the transforms
+    job.nbands = ntt_chunks(out1digits < out2digits ? out1digits : out2digits);
+    job.carries = malloc(2 * job.nbands * sizeof(uint64_t[3]));
+    pool_fork(ntt_pair_crt_task, &job, 2 * job.nbands);
+
+    // propagate the carries out of the bands, in order
+    for (unsigned k = 0; k < 2; ++k)
+    {
+        for (size_t i = 0; i + 1 < job.nbands; ++i)
+        {
+            ntt_crt_carry(job.out[k], band_begin(job.outdigits[k], job.nbands, i + 1),
+                    job.outdigits[k], job.carries[k * job.nbands + i]);
+        }
+    }
+    free(job.carries);
+}
+
+// (*result) = (*a) * (*b), writing exactly adigits + bdigits digits
+static void ntt_mul(
+        DIGIT *restrict result,
+        DIGIT const *const a, size_t const adigits,
+        DIGIT const *const b, size_t const bdigits)
+{
+    struct ntt ctx;
+    ntt_init(&ctx, ntt_size(adigits + bdigits - 1));
+
+    size_t const tbytes = 2 * NTT_NPRIMES * ctx.len * sizeof(uint64_t);
+    uint64_t *const ta = alloc_zeroed(tbytes);
+    uint64_t *const tb = &ta[NTT_NPRIMES * ctx.len];
+
+    ntt_forward(&ctx, ta, a, adigits);
+    ntt_forward(&ctx, tb, b, bdigits);
+    ntt_pointwise_mul(&ctx, ta, ta, tb);
+    ntt_inverse(&ctx, ta);
+    ntt_crt(result, adigits + bdigits, ta, ctx.len);
+
+    alloc_free(ta, tbytes);
+    ntt_free(&ctx);
+}
+
+// (*result) = (*a)^2, writing exactly 2 * ndigits digits
+static void ntt_sqr(
+        DIGIT *restrict result,
+        DIGIT const *const a, size_t const ndigits)
+{
+    struct ntt ctx;
+    ntt_init(&ctx, ntt_size(2 * ndigits - 1));
+
+    size_t const tbytes = NTT_NPRIMES * ctx.len * sizeof(uint64_t);
+    uint64_t *const ta = alloc_zeroed(tbytes);
+
+    ntt_forward(&ctx, ta, a, ndigits);
+    ntt_pointwise_mul(&ctx, ta, ta, ta);
+    ntt_inverse(&ctx, ta);
+    ntt_crt(result, 2 * ndigits, ta, ctx.len);
+
+    alloc_free(ta, tbytes);
+    ntt_free(&ctx);
+}
+
+#endif//NTT_H
@@ -0,0 +1,359 @@
+#ifndef POOL_H
+#define POOL_H
+
+// Work-stealing task runtime (included by mul.h).
+//
+// Built with FIB_THREADS=N, pool_init starts N - 1 workers, each of which owns
+// a deque of pending jobs; the thread calling pool_run owns the Nth deque.
+// pool_fork(task, arg, n) pushes the jobs task(arg, 1..n-1) onto the calling
+// thread's deque, runs task(arg, 0) itself, and then joins the jobs newest
+// first: a job that is still in the deque is simply popped and run inline,
+// and while waiting for a stolen one, the thread steals work itself.
+// Idle workers steal the oldest job of another deque (i.e. the biggest piece
+// of the recursion), and sleep when there is none.
+//
+// Jobs can fork again (and the multiplication engine does so, recursively, for
+// operands past FIB_SPAWN_THRESHOLD digits), which is what keeps every thread
+// busy on unbalanced trees of subproducts.
+//
+// Tasks never share outputs: products go to separate buffers, and sums are
+// cut into disjoint bands of digits (see band_begin), each of which reports
+// its carry out; the caller then propagates those carries band by band.
+// The results are thus identical to those of the serial build.
+//
+// Without FIB_THREADS, pool_fork runs its tasks in order on the calling thread,
+// and pool_parallel() is constantly 0, so the engine's parallel paths vanish.
+
+typedef void pool_task(void *arg, size_t index);
+
+// operands shorter than this are not worth waking the workers for
+#ifndef FIB_THREADS_THRESHOLD
+#   define FIB_THREADS_THRESHOLD 256
+#endif
+// subproducts of operands shorter than this run sequentially
+#ifndef FIB_SPAWN_THRESHOLD
+#   define FIB_SPAWN_THRESHOLD 2048
+#endif
+
+// first digit of the index-th of nbands (nearly) equal bands of len digits
+// (band index spans [band_begin(len, nbands, index), band_begin(len, nbands, index + 1)))
+static inline size_t band_begin(size_t const len, size_t const nbands, size_t const index)
+{
+    return len / nbands * index + (index < len % nbands ? index : len % nbands);
+}
+
+#ifdef FIB_THREADS
+
+#include <pthread.h>
+#include <sched.h>
+
+#ifndef POOL_DEQUE_LEN
+#   define POOL_DEQUE_LEN 1024
+#endif
+
+struct pool_job {
+    pool_task *task;
+    void *arg;
+    size_t index;
+    int done;
+};
+
+struct pool_deque {
+    pthread_mutex_t lock;
+    // jobs[top..bottom) are pending (modulo POOL_DEQUE_LEN); the owner pushes
+    // and pops at the bottom, thieves take from the top
+    size_t top;
+    size_t bottom;
+    struct pool_job *jobs[POOL_DEQUE_LEN];
+};
+
+struct pool;
+
+struct pool_thread {
+    struct pool *pool;
+    size_t id;
+    pthread_t thread;
+};
+
+struct pool {
+    size_t nthreads;
+    struct pool_thread *threads;
+    struct pool_deque *deques;
+    // deques set up by pool_init (which may have started fewer threads)
+    size_t ndeques;
+
+    // idle workers sleep until something is posted
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    unsigned long posted;
+    int stop;
+};
+
+// the pool (and deque) of the calling thread, if any
+static _Thread_local struct pool *pool_current;
+static _Thread_local size_t pool_id;
+
+// 1 if pool_fork would spread its tasks over several threads
+static inline int pool_parallel(void)
+{
+    return pool_current && pool_current->nthreads > 1;
+}
+
+// number of threads that pool_fork can spread its tasks over
+static inline size_t pool_size(void)
+{
+    return pool_current ? pool_current->nthreads : 1;
+}
+
+// returns 0 if the deque is full
+static int pool_push(struct pool_deque *const deque, struct pool_job *const job)
+{
+    pthread_mutex_lock(&deque->lock);
+    int const room = deque->bottom - deque->top < POOL_DEQUE_LEN;
+    if (room)
+    {
+        deque->jobs[deque->bottom++ % POOL_DEQUE_LEN] = job;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return room;
+}
+
+// takes job back from the bottom of the deque
+// returns 0 if it has been stolen
+static int pool_pop(struct pool_deque *const deque, struct pool_job *const job)
+{
+    pthread_mutex_lock(&deque->lock);
+    int const found = deque->bottom > deque->top && deque->jobs[(deque->bottom - 1) % POOL_DEQUE_LEN] == job;
+    if (found)
+    {
+        --deque->bottom;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// takes the oldest job of another thread, if any
+static struct pool_job *pool_steal(struct pool *const pool, size_t const id)
+{
+    for (size_t i = 1; i < pool->nthreads; ++i)
+    {
+        struct pool_deque *const deque = &pool->deques[(id + i) % pool->nthreads];
+        struct pool_job *job = NULL;
+        pthread_mutex_lock(&deque->lock);
+        if (deque->top < deque->bottom)
+        {
+            job = deque->jobs[deque->top++ % POOL_DEQUE_LEN];
+        }
+        pthread_mutex_unlock(&deque->lock);
+        if (job)
+        {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static void pool_execute(struct pool_job *const job)
+{
+    job->task(job->arg, job->index);
+    __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+}
+
+static void pool_join(struct pool *const pool, struct pool_job *const job)
+{
+    if (pool_pop(&pool->deques[pool_id], job))
+    {
+        pool_execute(job);
+        return;
+    }
+    while (!__atomic_load_n(&job->done, __ATOMIC_ACQUIRE))
+    {
+        struct pool_job *const other = pool_steal(pool, pool_id);
+        if (other)
+        {
+            pool_execute(other);
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+}
+
+// runs task(arg, i) for 0 <= i < ntasks, and waits for all of them
+static void pool_fork(pool_task *const task, void *const arg, size_t const ntasks)
+{
+    struct pool *const pool = pool_current;
+    if (!pool || pool->nthreads == 1 || ntasks == 1)
+    {
+        for (size_t i = 0; i < ntasks; ++i)
+        {
+            task(arg, i);
+        }
+        return;
+    }
+
+    struct pool_job *const jobs = malloc(ntasks * sizeof(struct pool_job));
+    if (!jobs)
+    {
+        for (size_t i = 0; i < ntasks; ++i)
+        {
+            task(arg, i);
+        }
+        return;
+    }
+    for (size_t i = ntasks; --i;)
+    {
+        jobs[i] = (struct pool_job){ .task = task, .arg = arg, .index = i, .done = 0 };
+        if (!pool_push(&pool->deques[pool_id], &jobs[i]))
+        {
+            pool_execute(&jobs[i]);
+        }
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    ++pool->posted;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    task(arg, 0);
+    for (size_t i = 1; i < ntasks; ++i)
+    {
+        pool_join(pool, &jobs[i]);
+    }
+    free(jobs);
+}
+
+static void *pool_worker(void *arg)
+{
+    struct pool_thread *const self = arg;
+    struct pool *const pool = self->pool;
+    pool_current = pool;
+    pool_id = self->id;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        unsigned long const seen = pool->posted;
+        int const stop = pool->stop;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop)
+        {
+            break;
+        }
+
+        struct pool_job *const job = pool_steal(pool, pool_id);
+        if (job)
+        {
+            pool_execute(job);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (pool->posted == seen && !pool->stop)
+        {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+// starts nthreads - 1 workers (the calling thread makes up the rest)
+// (if the memory or the threads cannot be had, the pool runs with fewer
+// threads, down to the calling thread alone)
+static inline void pool_init(struct pool *const pool, size_t const nthreads)
+{
+    pool->nthreads = nthreads ? nthreads : 1;
+    pool->threads = malloc(pool->nthreads * sizeof(struct pool_thread));
+    pool->deques = malloc(pool->nthreads * sizeof(struct pool_deque));
+    if (!pool->threads || !pool->deques)
+    {
+        free(pool->threads);
+        free(pool->deques);
+        pool->threads = NULL;
+        pool->deques = NULL;
+        pool->nthreads = 1;
+    }
+    pool->ndeques = pool->deques ? pool->nthreads : 0;
+    for (size_t i = 0; i < pool->ndeques; ++i)
+    {
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+        pool->deques[i].top = pool->deques[i].bottom = 0;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pool->posted = 0;
+    pool->stop = 0;
+
+    for (size_t i = 1; i < pool->nthreads; ++i)
+    {
+        pool->threads[i] = (struct pool_thread){ .pool = pool, .id = i };
+        if (pthread_create(&pool->threads[i].thread, NULL, pool_worker, &pool->threads[i]))
+        {
+            // run with whatever we have (no job has been posted yet)
+            pool->nthreads = i;
+            break;
+        }
+    }
+}
+
+static inline void pool_free(struct pool *const pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 1; i < pool->nthreads; ++i)
+    {
+        pthread_join(pool->threads[i].thread, NULL);
+    }
+    for (size_t i = 0; i < pool->ndeques; ++i)
+    {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+    }
+    free(pool->deques);
+    free(pool->threads);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+}
+
+// runs task(arg, i) for 0 <= i < ntasks on the pool (from outside of it),
+// and waits for all of them
+static inline void pool_run(struct pool *const pool, pool_task *const task, void *const arg, size_t const ntasks)
+{
+    struct pool *const outer = pool_current;
+    size_t const outer_id = pool_id;
+    pool_current = pool;
+    pool_id = 0;
+
+    pool_fork(task, arg, ntasks);
+
+    pool_current = outer;
+    pool_id = outer_id;
+}
+
+#else
+
+static inline int pool_parallel(void)
+{
+    return 0;
+}
+
+static inline size_t pool_size(void)
+{
+    return 1;
+}
+
+static inline void pool_fork(pool_task *const task, void *const arg, size_t const ntasks)
+{
+    for (size_t i = 0; i < ntasks; ++i)
+    {
+        task(arg, i);
+    }
+}
+
+#endif//FIB_THREADS
+
+#endif//POOL_H
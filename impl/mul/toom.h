@@ -0,0 +1,420 @@
+#ifndef TOOM_H
+#define TOOM_H
+
+// Toom-Cook multiplication (included by mul.h).
+//
+// Toom-p splits both operands into p parts of k digits (the top part may be
+// shorter), so that a = a(X) and b = b(X) are polynomials of degree p-1 in
+// X = 2^(DIGIT_BIT * k).
+// The product polynomial c = ab has degree 2p-2, so it is determined by its
+// values at 2p-1 points, each of which costs a single (k+1)-digit product.
+// The coefficients of c are then recovered by interpolation, which only
+// involves additions, shifts, and exact divisions by small odd constants.
+//
+// Interpolation intermediates may be negative; they are kept as L-digit
+// two's complement values (L = 2k + 2, which leaves plenty of room for the
+// small multiples of the products involved), so that the arithmetic is simply
+// modulo 2^(DIGIT_BIT * L), and exact division by odd constants is
+// multiplication by a modular inverse.
+
+// (*x) = -(*x) (mod 2^(DIGIT_BIT * len))
+static inline void tc_neg(DIGIT *const x, size_t const len)
+{
+    unsigned carry = 1;
+    for (size_t offset = 0; offset < len; ++offset)
+    {
+        carry = __builtin_add_overflow((DIGIT)~x[offset], (DIGIT)carry, &x[offset]);
+    }
+}
+
+// (*x) >>= shift, arithmetically (i.e. exact division by 2^shift)
+// shift must be strictly between 0 and DIGIT_BIT
+static inline void tc_shr(DIGIT *const x, unsigned const shift, size_t const len)
+{
+    for (size_t offset = 0; offset + 1 < len; ++offset)
+    {
+        x[offset] = (x[offset] >> shift) | (x[offset + 1] << (DIGIT_BIT - shift));
+    }
+    DIGIT const top = x[len - 1];
+    DIGIT const sign = -(top >> (DIGIT_BIT - 1));
+    x[len - 1] = (top >> shift) | (sign << (DIGIT_BIT - shift));
+}
+
+// (*x) += (*y) * scale (mod 2^(DIGIT_BIT * len))
+static inline void tc_addmul_1(
+        DIGIT *restrict x,
+        DIGIT const *restrict y, DIGIT const scale, size_t const len)
+{
+    DBDGT carry = 0;
+    for (size_t offset = 0; offset < len; ++offset)
+    {
+        DBDGT const acc
+            = ((DBDGT)x[offset])
+            + ((DBDGT)y[offset]) * scale
+            + carry;
+        x[offset] = (DIGIT)acc;
+        carry = acc >> DIGIT_BIT;
+    }
+}
+
+// (*x) -= (*y) * scale (mod 2^(DIGIT_BIT * len))
+static inline void tc_submul_1(
+        DIGIT *restrict x,
+        DIGIT const *restrict y, DIGIT const scale, size_t const len)
+{
+    DIGIT borrow = 0;
+    for (size_t offset = 0; offset < len; ++offset)
+    {
+        DBDGT const prod = ((DBDGT)y[offset]) * scale + borrow;
+        DIGIT const lo = (DIGIT)prod;
+        borrow = (DIGIT)(prod >> DIGIT_BIT) + (x[offset] < lo);
+        x[offset] -= lo;
+    }
+}
+
+// (*x) *= scale (mod 2^(DIGIT_BIT * len))
+static inline void tc_mul_1(DIGIT *const x, DIGIT const scale, size_t const len)
+{
+    DBDGT carry = 0;
+    for (size_t offset = 0; offset < len; ++offset)
+    {
+        DBDGT const acc = ((DBDGT)x[offset]) * scale + carry;
+        x[offset] = (DIGIT)acc;
+        carry = acc >> DIGIT_BIT;
+    }
+}
+
+// (*x) /= divisor, where divisor is odd and divides (*x) exactly
+// (Hensel division: the quotient is built from the least significant digit up)
+static inline void tc_divexact_1(DIGIT *const x, DIGIT const divisor, size_t const len)
+{
+    // Newton iteration for divisor^-1 mod 2^DIGIT_BIT
+    // (divisor is its own inverse mod 8, and each step doubles the correct bits)
+    DIGIT inverse = divisor;
+    for (unsigned bits = 3; bits < DIGIT_BIT; bits <<= 1)
+    {
+        inverse *= 2 - divisor * inverse;
+    }
+
+    DIGIT borrow = 0;
+    for (size_t offset = 0; offset < len; ++offset)
+    {
+        DIGIT const digit = x[offset];
+        DIGIT const quot = (digit - borrow) * inverse;
+        x[offset] = quot;
+        borrow = (DIGIT)((((DBDGT)quot) * divisor) >> DIGIT_BIT) + (digit < borrow);
+    }
+}
+
+// (*acc) = (*acc) * scale + (*part), where acc has k + 1 digits and part has len <= k digits
+static inline void toom_horner_step(
+        DIGIT *restrict acc,
+        DIGIT const *restrict part, size_t const len,
+        DIGIT const scale, size_t const k)
+{
+    DBDGT carry = 0;
+    size_t offset = 0;
+    for (; offset < len; ++offset)
+    {
+        DBDGT const tot
+            = ((DBDGT)acc[offset]) * scale
+            + part[offset]
+            + carry;
+        acc[offset] = (DIGIT)tot;
+        carry = tot >> DIGIT_BIT;
+    }
+    for (; offset <= k; ++offset)
+    {
+        DBDGT const tot = ((DBDGT)acc[offset]) * scale + carry;
+        acc[offset] = (DIGIT)tot;
+        carry = tot >> DIGIT_BIT;
+    }
+}
+
+// length of the ith part of an operand split into nparts parts of k digits
+static inline size_t toom_part_len(size_t const i, size_t const nparts, size_t const k, size_t const top)
+{
+    return i + 1 < nparts ? k : top;
+}
+
+// evaluates the operand (split into nparts parts) at +/- 2^shift
+// (*pos) = a(2^shift), (*neg) = |a(-2^shift)|, each k + 1 digits
+// returns 1 if a(-2^shift) < 0
+static inline int toom_eval_pm(
+        DIGIT *restrict pos, DIGIT *restrict neg,
+        DIGIT const *const a, unsigned const nparts,
+        size_t const k, size_t const top, unsigned const shift)
+{
+    // even parts in pos, odd parts in neg, by Horner's rule in x^2
+    unsigned const last_even = (nparts - 1) & ~1u;
+    unsigned const last_odd = (nparts - 2) | 1u;
+
+    memset(pos, 0, (k + 1) * sizeof(DIGIT));
+    memset(neg, 0, (k + 1) * sizeof(DIGIT));
+    for (unsigned i = last_even + 2; i >= 2; i -= 2)
+    {
+        toom_horner_step(pos, &a[(i - 2) * k], toom_part_len(i - 2, nparts, k, top),
+                (DIGIT)1 << (2 * shift), k);
+    }
+    for (unsigned i = last_odd + 2; i >= 3; i -= 2)
+    {
+        toom_horner_step(neg, &a[(i - 2) * k], toom_part_len(i - 2, nparts, k, top),
+                (DIGIT)1 << (2 * shift), k);
+    }
+    if (shift)
+    {
+        toom_horner_step(neg, NULL, 0, (DIGIT)1 << shift, k);
+    }
+
+    // (even, odd) -> (even + odd, |even - odd|)
+    int const negative = !geq_n(pos, neg, k + 1);
+    unsigned carry = 0;
+    unsigned borrow = 0;
+    for (size_t offset = 0; offset <= k; ++offset)
+    {
+        DIGIT const even = pos[offset];
+        DIGIT const odd = neg[offset];
+        DIGIT const big = negative ? odd : even;
+        DIGIT const small = negative ? even : odd;
+
+        DIGIT tot;
+        unsigned const c1 = __builtin_add_overflow(even, odd, &tot);
+        unsigned const c2 = __builtin_add_overflow(tot, (DIGIT)carry, &pos[offset]);
+        carry = c1 | c2;
+
+        DIGIT diff;
+        unsigned const b1 = __builtin_sub_overflow(big, small, &diff);
+        unsigned const b2 = __builtin_sub_overflow(diff, (DIGIT)borrow, &neg[offset]);
+        borrow = b1 | b2;
+    }
+    return negative;
+}
+
+// (*result) = (*a) * (*b), each len digits, extended to outlen digits
+// negated (in two's complement) if negative is set
+static inline void toom_product(
+        DIGIT *restrict result,
+        DIGIT const *const a, DIGIT const *const b,
+        size_t const len, size_t const outlen,
+        int const negative, DIGIT *restrict scratch)
+{
+    if (a == b)
+    {
+        sqr_n(result, a, len, scratch);
+    }
+    else
+    {
+        mul_n(result, a, b, len, scratch);
+    }
+    memset(&result[2 * len], 0, (outlen - 2 * len) * sizeof(DIGIT));
+    if (negative)
+    {
+        tc_neg(result, outlen);
+    }
+}
+
+// (*result) = sum of coeffs[i] X^i, writing exactly ndigits digits
+static inline void toom_recompose(
+        DIGIT *restrict result, size_t const ndigits,
+        DIGIT *const *const coeffs, unsigned const ncoeffs,
+        size_t const k, size_t const len)
+{
+    memset(result, 0, ndigits * sizeof(DIGIT));
+    for (unsigned i = 0; i < ncoeffs; ++i)
+    {
+        size_t const room = ndigits - i * k;
+        add_accum(&result[i * k], coeffs[i], normalised_len(coeffs[i], room < len ? room : len));
+    }
+}
+
+// Toom-3 (points 0, 1, -1, -2, infinity); squares if a == b
+//
+// With v(x) = a(x) b(x), the interpolation follows Bodrato's sequence:
+//     c3 = (v(-2) - v(1)) / 3
+//     c1 = (v(1) - v(-1)) / 2
+//     c2 = v(-1) - v(0)
+//     c3 = (c2 - c3) / 2 + 2 v(inf)
+//     c2 = c2 + c1 - v(inf)
+//     c1 = c1 - c3
+static void toom3_mul_n(
+        DIGIT *restrict result,
+        DIGIT const *const a, DIGIT const *const b,
+        size_t const ndigits, DIGIT *restrict scratch)
+{
+    size_t const k = (ndigits + 2) / 3;
+    size_t const top = ndigits - 2 * k;
+    size_t const len = 2 * k + 2;
+
+    DIGIT *const v0 = scratch;
+    DIGIT *const v1 = &v0[len];
+    DIGIT *const vm1 = &v1[len];
+    DIGIT *const vm2 = &vm1[len];
+    DIGIT *const vinf = &vm2[len];
+    DIGIT *const apos = &vinf[len];
+    DIGIT *const aneg = &apos[k + 1];
+    DIGIT *const bpos = &aneg[k + 1];
+    DIGIT *const bneg = &bpos[k + 1];
+    DIGIT *const next = &bneg[k + 1];
+
+    int const square = a == b;
+    DIGIT const *const bpos_ = square ? apos : bpos;
+    DIGIT const *const bneg_ = square ? aneg : bneg;
+    int asign, bsign;
+
+    toom_product(v0, a, square ? a : b, k, len, 0, next);
+    toom_product(vinf, &a[2 * k], square ? &a[2 * k] : &b[2 * k], top, len, 0, next);
+
+    asign = toom_eval_pm(apos, aneg, a, 3, k, top, 0);
+    bsign = square ? asign : toom_eval_pm(bpos, bneg, b, 3, k, top, 0);
+    toom_product(v1, apos, bpos_, k + 1, len, 0, next);
+    toom_product(vm1, aneg, bneg_, k + 1, len, asign ^ bsign, next);
+
+    asign = toom_eval_pm(apos, aneg, a, 3, k, top, 1);
+    bsign = square ? asign : toom_eval_pm(bpos, bneg, b, 3, k, top, 1);
+    toom_product(vm2, aneg, bneg_, k + 1, len, asign ^ bsign, next);
+
+    // c3 = (v(-2) - v(1)) / 3
+    sub_n(vm2, vm2, v1, len);
+    tc_divexact_1(vm2, 3, len);
+    // c1 = (v(1) - v(-1)) / 2
+    sub_n(v1, v1, vm1, len);
+    tc_shr(v1, 1, len);
+    // c2 = v(-1) - v(0)
+    sub_n(vm1, vm1, v0, len);
+    // c3 = (c2 - c3) / 2 + 2 v(inf)
+    sub_n(vm2, vm1, vm2, len);
+    tc_shr(vm2, 1, len);
+    tc_addmul_1(vm2, vinf, 2, len);
+    // c2 = c2 + c1 - v(inf)
+    add_n(vm1, vm1, v1, len);
+    sub_n(vm1, vm1, vinf, len);
+    // c1 = c1 - c3
+    sub_n(v1, v1, vm2, len);
+
+    DIGIT *const coeffs[] = { v0, v1, vm1, vm2, vinf };
+    toom_recompose(result, 2 * ndigits, coeffs, 5, k, len);
+}
+
+static void toom3_sqr_n(
+        DIGIT *restrict result,
+        DIGIT const *const a,
+        size_t const ndigits, DIGIT *restrict scratch)
+{
+    toom3_mul_n(result, a, a, ndigits, scratch);
+}
+
+// Toom-4 (points 0, 1, -1, 2, -2, 1/2, infinity); squares if a == b
+//
+// With v(x) = a(x) b(x) and h = 64 v(1/2), the interpolation goes through the
+// even and odd parts of v:
+//     d1 = (v(1) - v(-1)) / 2            = c1 + c3 + c5
+//     e1 = (v(1) + v(-1)) / 2 - c0 - c6  = c2 + c4
+//     d2 = (v(2) - v(-2)) / 4            = c1 + 4c3 + 16c5
+//     e2 = ((v(2) + v(-2)) / 2 - c0 - 64c6) / 4 = c2 + 4c4
+//     c4 = (e2 - e1) / 3, c2 = e1 - c4
+//     h' = (h - 64c0 - 16c2 - 4c4 - c6) / 2 = 16c1 + 4c3 + c5
+//     p = (d2 - d1) / 3 = c3 + 5c5, q = (h' - d1) / 3 = 5c1 + c3
+//     c3 = (5d1 - p - q) / 3, c5 = (p - c3) / 5, c1 = (q - c3) / 5
+static void toom4_mul_n(
+        DIGIT *restrict result,
+        DIGIT const *const a, DIGIT const *const b,
+        size_t const ndigits, DIGIT *restrict scratch)
+{
+    size_t const k = (ndigits + 3) / 4;
+    size_t const top = ndigits - 3 * k;
+    size_t const len = 2 * k + 2;
+
+    DIGIT *const v0 = scratch;
+    DIGIT *const v1 = &v0[len];
+    DIGIT *const vm1 = &v1[len];
+    DIGIT *const v2 = &vm1[len];
+    DIGIT *const vm2 = &v2[len];
+    DIGIT *const vh = &vm2[len];
+    DIGIT *const vinf = &vh[len];
+    DIGIT *const apos = &vinf[len];
+    DIGIT *const aneg = &apos[k + 1];
+    DIGIT *const bpos = &aneg[k + 1];
+    DIGIT *const bneg = &bpos[k + 1];
+    DIGIT *const next = &bneg[k + 1];
+
+    int const square = a == b;
+    DIGIT const *const bpos_ = square ? apos : bpos;
+    DIGIT const *const bneg_ = square ? aneg : bneg;
+    int asign, bsign;
+
+    toom_product(v0, a, square ? a : b, k, len, 0, next);
+    toom_product(vinf, &a[3 * k], square ? &a[3 * k] : &b[3 * k], top, len, 0, next);
+
+    for (unsigned shift = 0; shift <= 1; ++shift)
+    {
+        asign = toom_eval_pm(apos, aneg, a, 4, k, top, shift);
+        bsign = square ? asign : toom_eval_pm(bpos, bneg, b, 4, k, top, shift);
+        toom_product(shift ? v2 : v1, apos, bpos_, k + 1, len, 0, next);
+        toom_product(shift ? vm2 : vm1, aneg, bneg_, k + 1, len, asign ^ bsign, next);
+    }
+
+    // 8 a(1/2) = 8a0 + 4a1 + 2a2 + a3
+    memset(apos, 0, (k + 1) * sizeof(DIGIT));
+    memset(bpos, 0, (k + 1) * sizeof(DIGIT));
+    for (unsigned i = 0; i < 4; ++i)
+    {
+        toom_horner_step(apos, &a[i * k], toom_part_len(i, 4, k, top), 2, k);
+        if (!square)
+        {
+            toom_horner_step(bpos, &b[i * k], toom_part_len(i, 4, k, top), 2, k);
+        }
+    }
+    toom_product(vh, apos, bpos_, k + 1, len, 0, next);
+
+    // d1 in v1, e1 in vm1
+    sub_n(v1, v1, vm1, len);
+    tc_shr(v1, 1, len);
+    add_n(vm1, vm1, v1, len);
+    sub_n(vm1, vm1, v0, len);
+    sub_n(vm1, vm1, vinf, len);
+    // d2 in v2, e2 in vm2
+    sub_n(v2, v2, vm2, len);
+    tc_shr(v2, 2, len);
+    tc_addmul_1(vm2, v2, 2, len);
+    sub_n(vm2, vm2, v0, len);
+    tc_submul_1(vm2, vinf, 64, len);
+    tc_shr(vm2, 2, len);
+    // c4 in vm2, c2 in vm1
+    sub_n(vm2, vm2, vm1, len);
+    tc_divexact_1(vm2, 3, len);
+    sub_n(vm1, vm1, vm2, len);
+    // h' in vh
+    tc_submul_1(vh, v0, 64, len);
+    tc_submul_1(vh, vm1, 16, len);
+    tc_submul_1(vh, vm2, 4, len);
+    sub_n(vh, vh, vinf, len);
+    tc_shr(vh, 1, len);
+    // p in v2, q in vh
+    sub_n(v2, v2, v1, len);
+    tc_divexact_1(v2, 3, len);
+    sub_n(vh, vh, v1, len);
+    tc_divexact_1(vh, 3, len);
+    // c3 in v1
+    tc_mul_1(v1, 5, len);
+    sub_n(v1, v1, v2, len);
+    sub_n(v1, v1, vh, len);
+    tc_divexact_1(v1, 3, len);
+    // c5 in v2, c1 in vh
+    sub_n(v2, v2, v1, len);
+    tc_divexact_1(v2, 5, len);
+    sub_n(vh, vh, v1, len);
+    tc_divexact_1(vh, 5, len);
+
+    DIGIT *const coeffs[] = { v0, vh, vm1, v1, vm2, v2, vinf };
+    toom_recompose(result, 2 * ndigits, coeffs, 7, k, len);
+}
+
+static void toom4_sqr_n(
+        DIGIT *restrict result,
+        DIGIT const *const a,
+        size_t const ndigits, DIGIT *restrict scratch)
+{
+    toom4_mul_n(result, a, a, ndigits, scratch);
+}
+
+#endif//TOOM_H
@@ -0,0 +1,197 @@
+#include "micro.h"
+#include "impl/mul/cpu.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __x86_64__
+#   include <x86intrin.h>
+#endif
+
+// Times the kernels of one implementation (see micro.h) over a sweep of
+// operand lengths, and prints the cycles they take per limb (or, for the
+// quadratic kernels, per limb product, i.e. per n^2), as a table meant to be
+// diffed between compilers, flags and CPUs.
+//
+// Cycles are read from the time-stamp counter, which ticks at the nominal
+// frequency of the CPU: they are reference cycles, which only match core
+// cycles with frequency scaling (and turbo) disabled. Pin the benchmark to a
+// quiet CPU (e.g. taskset -c 2) for stable numbers.
+
+// linear kernels sweep operands up to this many bytes (well beyond L3)
+#ifndef MICRO_MAX_BYTES
+#   define MICRO_MAX_BYTES (1 << 25)
+#endif
+// quadratic kernels stop at this many digits (where the multiplication
+// engine takes over anyway)
+#ifndef MICRO_MAX_QUADRATIC
+#   define MICRO_MAX_QUADRATIC 4096
+#endif
+// each measurement is the fastest of MICRO_BATCHES batches of calls, each
+// batch taking about MICRO_BATCH_CYCLES
+#define MICRO_BATCHES 7
+#define MICRO_BATCH_CYCLES (1 << 22)
+
+#ifdef __x86_64__
+#   define MICRO_UNIT "cycles"
+#else
+#   define MICRO_UNIT "ns"
+#endif
+
+static inline uint64_t micro_clock(void)
+{
+#   ifdef __x86_64__
+    // keep the kernel from being reordered around the reads
+    _mm_lfence();
+    uint64_t const now = __rdtsc();
+    _mm_lfence();
+    return now;
+#   else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+#   endif
+}
+
+// next length of the sweep: 1, 2, 3, 4, 6, 8, 12, 16, ...
+static size_t micro_next(size_t const n)
+{
+    if (n < 2)
+    {
+        return n + 1;
+    }
+    return n & (n - 1) ? n / 3 * 4 : n / 2 * 3;
+}
+
+// fills bytes with (deterministic) noise, so that no digit is zero
+static void micro_fill(unsigned char *const bytes, size_t const len)
+{
+    uint64_t state = 0x9e3779b97f4a7c15u;
+    for (size_t i = 0; i < len; ++i)
+    {
+        // xorshift64
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        bytes[i] = (unsigned char)(state | 1);
+    }
+}
+
+// cycles (or nanoseconds) per call of the kernel on operands of n digits
+static double micro_measure(
+        struct micro_kernel const *const kernel,
+        unsigned char *const accum1, unsigned char *const accum2,
+        unsigned char const *const a, unsigned char const *const b, size_t const n)
+{
+    // warm up (caches, TLB, frequency), and calibrate the size of a batch
+    uint64_t start = micro_clock();
+    kernel->run(accum1, accum2, a, b, n);
+    uint64_t elapsed = micro_clock() - start;
+    uint64_t calls = elapsed ? MICRO_BATCH_CYCLES / elapsed : MICRO_BATCH_CYCLES;
+    if (calls == 0)
+    {
+        calls = 1;
+    }
+
+    double best = 0;
+    for (unsigned batch = 0; batch < MICRO_BATCHES; ++batch)
+    {
+        start = micro_clock();
+        for (uint64_t call = 0; call < calls; ++call)
+        {
+            kernel->run(accum1, accum2, a, b, n);
+        }
+        elapsed = micro_clock() - start;
+        double const per_call = (double)elapsed / calls;
+        if (batch == 0 || per_call < best)
+        {
+            best = per_call;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char *argv[])
+{
+    // kernels to time (all of them if none are given)
+    for (int arg = 1; arg < argc; ++arg)
+    {
+        size_t k = 0;
+        while (k < micro_nkernels && strcmp(argv[arg], micro_kernels[k].name) != 0)
+        {
+            ++k;
+        }
+        if (k == micro_nkernels)
+        {
+            fprintf(stderr, "Unknown kernel %s.\nKernels:", argv[arg]);
+            for (k = 0; k < micro_nkernels; ++k)
+            {
+                fprintf(stderr, " %s", micro_kernels[k].name);
+            }
+            fputc('\n', stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("# Compiler: %s\n", __VERSION__);
+    printf("# Kernels: %s\n", cpu_tier_names[cpu_tier()]);
+    printf("# Clock: %s\n", MICRO_UNIT);
+    printf(
+        "#              Kernel |      Limbs |  Limb (B) |  %6s/call |  %6s/unit | Unit\n"
+        "# --------------------+------------+-----------+--------------+--------------+--------\n",
+        MICRO_UNIT, MICRO_UNIT
+    );
+
+    for (size_t k = 0; k < micro_nkernels; ++k)
+    {
+        struct micro_kernel const *const kernel = &micro_kernels[k];
+        int selected = argc <= 1;
+        for (int arg = 1; arg < argc; ++arg)
+        {
+            selected |= strcmp(argv[arg], kernel->name) == 0;
+        }
+        if (!selected)
+        {
+            continue;
+        }
+
+        size_t const max_len = kernel->quadratic ? MICRO_MAX_QUADRATIC : MICRO_MAX_BYTES / kernel->digit_size;
+        // operands of n + 2 digits, accumulators of 2n + 4 digits
+        size_t const operand_bytes = (max_len + 2) * kernel->digit_size;
+        size_t const accum_bytes = 2 * operand_bytes;
+        unsigned char *const buffer = malloc(2 * operand_bytes + 2 * accum_bytes);
+        if (!buffer)
+        {
+            fprintf(stderr, "Failed to allocate buffers for %s.\n", kernel->name);
+            return EXIT_FAILURE;
+        }
+        unsigned char *const a = buffer;
+        unsigned char *const b = &a[operand_bytes];
+        unsigned char *const accum1 = &b[operand_bytes];
+        unsigned char *const accum2 = &accum1[accum_bytes];
+
+        for (size_t n = 1; n <= max_len; n = micro_next(n))
+        {
+            size_t const len = n * kernel->digit_size;
+            micro_fill(a, len);
+            micro_fill(b, len);
+            memset(&a[len], 0, 2 * kernel->digit_size);
+            memset(&b[len], 0, 2 * kernel->digit_size);
+            micro_fill(accum1, 2 * len + 4 * kernel->digit_size);
+            micro_fill(accum2, 2 * len + 4 * kernel->digit_size);
+
+            double const per_call = micro_measure(kernel, accum1, accum2, a, b, n);
+            double const units = kernel->quadratic ? (double)n * n : (double)n;
+            printf("%21s | %10llu | %9llu | %12.1f | %12.3f | %s\n",
+                kernel->name, (long long unsigned)n, (long long unsigned)kernel->digit_size,
+                per_call, per_call / units, kernel->quadratic ? "limb^2" : "limb");
+            fflush(stdout);
+        }
+        free(buffer);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,25 @@
+#ifndef MICRO_H
+#define MICRO_H
+
+#include <stddef.h>
+
+// Kernels of an implementation, timed in isolation by micro.c.
+//
+// Implementations compiled with MICRO_KERNELS (see the Makefile) export a
+// table of their limb-level kernels, wrapped to a common signature: each
+// kernel runs on operands a and b of n digits (followed by two zero digits),
+// and writes or accumulates into accum1 and accum2, of 2n + 4 digits each.
+// The operands are arbitrary, so the results are meaningless: only the time
+// taken matters.
+
+struct micro_kernel {
+    char const *name;
+    size_t digit_size; // bytes
+    int quadratic; // whether the work grows with n^2 (rather than n)
+    void (*run)(void *accum1, void *accum2, void const *a, void const *b, size_t n);
+};
+
+extern struct micro_kernel const micro_kernels[];
+extern size_t const micro_nkernels;
+
+#endif//MICRO_H
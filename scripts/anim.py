@@ -2,6 +2,7 @@ import matplotlib.pyplot as plt
 import matplotlib.animation as animation
 
 from dataclasses import dataclass, field
+import csv
 import json
 import os
 
@@ -15,6 +16,9 @@ class DataFile:
     path: str
     colour: str
     style: str | tuple[int, tuple[int, ...]] # (offset, (on_off_sequence))
+    # statistic plotted from benchmark files (`eval.c --format=csv|json`),
+    # e.g. "cpu_median", "wall_min" or "wall_p90"
+    metric: str = "cpu_median"
     data: list[Data] = field(
         default_factory=lambda: [],
         init=False
@@ -22,30 +26,47 @@ class DataFile:
 
     def __post_init__(self):
         with open(self.path) as data:
-            for line in data:
-                if line.startswith('#'):
-                    continue
-                if ':' in line:
-                    # old-fashioned data file
-                    index, _, time = map(str.strip, line.split('::'))
-                else:
-                    # new data file
-                    index, time, _ = map(str.strip, line.split('|'))
-                    time = time[:-1] # remove trailing 's'
-
-                index = int(index)
-                time = float(time)
-                self.data.append(Data(index, time))
+            head = data.read(1)
+            data.seek(0)
+            if head == '{':
+                # benchmark file (JSON)
+                clock, stat = self.metric.split('_')
+                for result in json.load(data)["results"]:
+                    self.data.append(Data(result["index"], result[clock][stat]))
+            elif head == 'i':
+                # benchmark file (CSV)
+                for row in csv.DictReader(data):
+                    self.data.append(Data(int(row["index"]), float(row[self.metric])))
+            else:
+                self.load_table(data)
 
         while self.data[-2].time > 1.:
             self.data.pop()
 
+    def load_table(self, data):
+        # text table (`eval.c`), or old-fashioned data file
+        for line in data:
+            if line.startswith('#'):
+                continue
+            if ':' in line:
+                # old-fashioned data file
+                index, _, time = map(str.strip, line.split('::'))
+            else:
+                # new data file
+                index, time, *_ = map(str.strip, line.split('|'))
+                time = time[:-1] # remove trailing 's'
+
+            index = int(index)
+            time = float(time)
+            self.data.append(Data(index, time))
+
     @classmethod
     def fromdict(cls, dc: dict[str, str], *, root: str = None):
         return cls(
             path=dc["path"] if root is None else os.path.join(root, dc["path"]),
             colour=dc["colour"],
             style=dc.get("style", "solid"),
+            metric=dc.get("metric", "cpu_median"),
         )
 
 def load_data(fname: str, *, level: int = None) -> dict[str, DataFile]:
@@ -0,0 +1,53 @@
+import mmap
+import struct
+import typing
+import zlib
+
+# reader for the binary containers written by `hex.out --bin` (see fibfile.h)
+
+MAGIC = b"FIBSHEAF"
+ENDIAN = 0xAABB
+VERSION = 1
+HEADER = "8sHHIQQII24x"
+
+
+class FibFile(typing.NamedTuple):
+    index: int
+    # little-endian bytes of the number (a zero-copy view of the mapping)
+    data: memoryview
+
+    def to_int(self) -> int:
+        return int.from_bytes(self.data, "little")
+
+    def to_hex(self) -> str:
+        # same digits as the hex output of hex.out (including leading zero bytes)
+        return self.data[::-1].tobytes().hex()
+
+
+def is_container(path: str) -> bool:
+    with open(path, "rb") as fp:
+        return fp.read(len(MAGIC)) == MAGIC
+
+
+def load(path: str, *, check: bool = True) -> FibFile:
+    with open(path, "rb") as fp:
+        buffer = mmap.mmap(fp.fileno(), 0, access=mmap.ACCESS_READ)
+
+    magic, endian, *_ = struct.unpack_from("<" + HEADER, buffer)
+    if magic != MAGIC:
+        raise ValueError(f"{path} is not a Fibonacci container")
+    # header fields are stored in the byte order of the writer
+    order = "<" if endian == ENDIAN else ">"
+    _, endian, version, _, index, length, checksum, header_size = struct.unpack_from(order + HEADER, buffer)
+
+    if endian != ENDIAN:
+        raise ValueError(f"{path} is not a Fibonacci container")
+    if version != VERSION:
+        raise ValueError(f"{path}: unsupported version {version}")
+    if header_size + length > len(buffer):
+        raise ValueError(f"{path} is truncated")
+
+    data = memoryview(buffer)[header_size:header_size + length]
+    if check and zlib.crc32(data) != checksum:
+        raise ValueError(f"{path}: checksum mismatch")
+    return FibFile(index, data)
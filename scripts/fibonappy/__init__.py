@@ -2,7 +2,7 @@ import typing
 
 # field_ext implementation in Python
 
-def main(fname: typing.Optional[str], n: int, fibonacci: typing.Callable[[int], int]):
+def main(fname: typing.Optional[str], n: int, fibonacci: typing.Callable[[int], int], check: typing.Optional[str] = None):
     import time
     import sys
 
@@ -10,6 +10,19 @@ def main(fname: typing.Optional[str], n: int, fibonacci: typing.Callable[[int],
     fib = fibonacci(n)
     end_time = time.time()
 
+    if check is not None:
+        from .. import fibbin
+        expected = fibbin.load(check)
+        print(f"# Runtime: {end_time-start_time:.9f}s", file=sys.stderr)
+        if expected.index != n:
+            print(f"# Check:   {check} holds F_{expected.index}, not F_{n}", file=sys.stderr)
+            sys.exit(1)
+        if expected.to_int() != fib:
+            print(f"# Check:   {check} does not match", file=sys.stderr)
+            sys.exit(1)
+        print(f"# Check:   {check} matches", file=sys.stderr)
+        return
+
     if fname is None:
         fp = sys.stdout
     else:
@@ -33,5 +46,7 @@ def argparser():
                         help="desired Fibonacci index")
     parser.add_argument("fname", metavar="FILE", type=str, nargs='?',
                         help="output file to store result (or stdout if not provided)")
+    parser.add_argument("--check", metavar="CONTAINER", type=str,
+                        help="instead of printing the result, compare it against a container written by --bin")
 
     return parser
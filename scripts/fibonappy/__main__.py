@@ -4,4 +4,4 @@ if __name__ == "__main__":
     from .fast_double import fibonacci
 
     args = argparser().parse_args()
-    main(args.fname, args.n, fibonacci)
+    main(args.fname, args.n, fibonacci, args.check)
@@ -25,4 +25,4 @@ if __name__ == "__main__":
     from . import argparser, main
 
     args = argparser().parse_args()
-    main(args.fname, args.n, fibonacci)
+    main(args.fname, args.n, fibonacci, args.check)
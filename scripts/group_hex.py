@@ -27,9 +27,11 @@ if __name__ == "__main__":
     import argparse
     import sys
 
+    import fibbin
+
     parser = argparse.ArgumentParser()
     parser.add_argument("-i", "--input", metavar="FILE",
-                        help="Input source. If not provided, input is read from stdin.")
+                        help="Input source (hex, or a container written by --bin). If not provided, input is read from stdin.")
     parser.add_argument("-o", "--output", metavar="FILE",
                         help="Output. If not provided, output is written to stdout.")
     parser.add_argument("--chunk", type=int, default=4,
@@ -39,12 +41,16 @@ if __name__ == "__main__":
 
     args = parser.parse_args()
 
-    source_file = open(args.input) if args.input is not None else sys.stdin
     output_file = open(args.output, 'w') if args.output is not None else sys.stdout
 
-    source = ''.join(map(str.strip, source_file))
-    if args.input is not None:
-        source_file.close()
+    if args.input is not None and fibbin.is_container(args.input):
+        source = fibbin.load(args.input).to_hex()
+    else:
+        source_file = open(args.input) if args.input is not None else sys.stdin
+
+        source = ''.join(map(str.strip, source_file))
+        if args.input is not None:
+            source_file.close()
 
     group(output_file, source, chunk_width=args.chunk, num_chunks=args.nchunks)
 
@@ -12,8 +12,12 @@ def hex2dec(fp: typing.TextIO, src: str, *, ndigits: int):
         print(f"Invalid character {char!r} at index {index+1}.", file=sys.stderr)
         exit(1)
 
+    int2dec(fp, x, ndigits=ndigits)
+
+
+def int2dec(fp: typing.TextIO, x: int, *, ndigits: int):
     dec = str(x)
-    if ndigits == -1 or len(dec) <= ndigits:
+    if ndigits <= 0 or len(dec) <= ndigits:
         fp.write(dec)
     else:
         lead, *rest = dec[:ndigits+1]
@@ -26,25 +30,30 @@ def hex2dec(fp: typing.TextIO, src: str, *, ndigits: int):
 if __name__ == "__main__":
 
     import argparse
+    import fibbin
 
     parser = argparse.ArgumentParser()
     parser.add_argument("-i", "--input", metavar="FILE",
-                        help="Input source. If not provided, input is read from stdin.")
+                        help="Input source (hex, or a container written by --bin). If not provided, input is read from stdin.")
     parser.add_argument("-o", "--output", metavar="FILE",
                         help="Output. If not provided, output is written to stdout.")
-    parser.add_argument("-n", "--ndigits", default=32,
+    parser.add_argument("-n", "--ndigits", type=int, default=32,
                         help="Number of digits to emit, or 0 to emit all digits.")
 
     args = parser.parse_args()
 
-    source_file = open(args.input) if args.input is not None else sys.stdin
     output_file = open(args.output, 'w') if args.output is not None else sys.stdout
 
-    source = ''.join(map(str.strip, source_file))
-    if args.input is not None:
-        source_file.close()
+    if args.input is not None and fibbin.is_container(args.input):
+        int2dec(output_file, fibbin.load(args.input).to_int(), ndigits=args.ndigits)
+    else:
+        source_file = open(args.input) if args.input is not None else sys.stdin
+
+        source = ''.join(map(str.strip, source_file))
+        if args.input is not None:
+            source_file.close()
 
-    hex2dec(output_file, source, ndigits=args.ndigits)
+        hex2dec(output_file, source, ndigits=args.ndigits)
 
     if args.output is not None:
         output_file.close()
@@ -0,0 +1,97 @@
+import os
+import subprocess
+import struct
+import sys
+import tempfile
+
+# sweeps several implementations at once, over one pool of pinned CPUs:
+#   python3 scripts/sweep.py [--cpus=list|auto] [--format=...] [eval options] impl...
+# writes data/<impl>.dat (or .csv, .json with --format), every sweep taking
+# its CPUs from the same FIFO of free CPUs (`eval.c --cpu-pool`), so that a
+# CPU runs a single point of a single implementation at any time, and each
+# file still gets its rows in order
+
+SYS_CPU = "/sys/devices/system/cpu"
+EXTENSIONS = {"text": "dat", "csv": "csv", "json": "json"}
+
+
+def parse_cpu_list(cpu_list: str) -> set[int]:
+    cpus = set()
+    for part in filter(None, cpu_list.strip().split(',')):
+        first, _, last = part.partition('-')
+        cpus.update(range(int(first), int(last or first) + 1))
+    return cpus
+
+
+def read_cpu_list(path: str) -> set[int]:
+    try:
+        with open(path) as f:
+            return parse_cpu_list(f.read())
+    except OSError:
+        return set()
+
+
+# same choice as `eval.c --cpus` (isolated, else allowed, CPUs for "auto";
+# one hardware thread per core)
+def select_cpus(cpu_list: str) -> list[int]:
+    if cpu_list == "auto":
+        candidates = read_cpu_list(f"{SYS_CPU}/isolated") or os.sched_getaffinity(0)
+    else:
+        candidates = parse_cpu_list(cpu_list)
+    candidates &= read_cpu_list(f"{SYS_CPU}/online") or candidates
+    chosen = []
+    for cpu in sorted(candidates):
+        siblings = read_cpu_list(f"{SYS_CPU}/cpu{cpu}/topology/thread_siblings_list")
+        if not siblings & set(chosen):
+            chosen.append(cpu)
+    return chosen
+
+
+def sweep(impls: list[str], cpus: list[int], options: list[str], bin_dir="bin", data_dir="data") -> bool:
+    fmt = "text"
+    for option in options:
+        if option.startswith("--format="):
+            fmt = option.removeprefix("--format=")
+    cpu_list = ','.join(map(str, cpus))
+
+    with tempfile.TemporaryDirectory() as tmp:
+        pool_path = os.path.join(tmp, "cpus")
+        os.mkfifo(pool_path)
+        # kept open for the whole sweep, so the pool outlives any one reader
+        pool = os.open(pool_path, os.O_RDWR)
+        os.write(pool, b"".join(struct.pack("=H", cpu) for cpu in cpus))
+
+        sweeps = []
+        for impl in impls:
+            out = open(os.path.join(data_dir, f"{impl}.{EXTENSIONS[fmt]}"), "w")
+            command = [os.path.join(bin_dir, f"{impl}.out"), f"--cpus={cpu_list}", f"--cpu-pool={pool_path}", *options]
+            sweeps.append((impl, out, subprocess.Popen(command, stdout=out)))
+
+        ok = True
+        for impl, out, process in sweeps:
+            status = process.wait()
+            out.close()
+            if status != 0:
+                print(f"{impl}: sweep failed (exit status {status})", file=sys.stderr)
+                ok = False
+        os.close(pool)
+    return ok
+
+
+if __name__ == "__main__":
+    cpu_list = "auto"
+    options = []
+    impls = []
+    for arg in sys.argv[1:]:
+        if arg.startswith("--cpus="):
+            cpu_list = arg.removeprefix("--cpus=")
+        elif arg.startswith("--"):
+            options.append(arg)
+        else:
+            impls.append(arg)
+
+    cpus = select_cpus(cpu_list)
+    if not impls or not cpus:
+        print(f"Usage: {sys.argv[0]} [--cpus=list|auto] [eval options] impl...", file=sys.stderr)
+        sys.exit(1)
+    sys.exit(0 if sweep(impls, cpus, options) else 1)
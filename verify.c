@@ -0,0 +1,105 @@
+#include "verify.h"
+
+// The primes are all of the form 2^bits - c with a small c, so that residues
+// are reduced without divisions: x = hi 2^bits + lo = hi c + lo (mod p).
+struct verify_prime {
+    unsigned bits;
+    uint64_t c;
+};
+
+static struct verify_prime const verify_primes[] = {
+    { 61, 1 },
+    { 62, 57 },
+    { 62, 87 },
+};
+
+#define VERIFY_NPRIMES (sizeof(verify_primes) / sizeof(*verify_primes))
+
+static inline uint64_t verify_reduce(__uint128_t x, struct verify_prime const p)
+{
+    uint64_t const modulus = (UINT64_C(1) << p.bits) - p.c;
+    uint64_t const mask = (UINT64_C(1) << p.bits) - 1;
+    while (x >> p.bits)
+    {
+        x = (x >> p.bits) * p.c + (x & mask);
+    }
+    return (uint64_t)x >= modulus ? (uint64_t)x - modulus : (uint64_t)x;
+}
+
+static inline uint64_t verify_mul(uint64_t const a, uint64_t const b, struct verify_prime const p)
+{
+    return verify_reduce((__uint128_t)a * b, p);
+}
+
+// F(index) mod p, by the doubling formulas (i.e. squaring powers of the
+// matrix [[1, 1], [1, 0]], whose entries are Fibonacci numbers):
+//     F(2k) = F(k) (2 F(k+1) - F(k)),  F(2k+1) = F(k)^2 + F(k+1)^2
+static uint64_t verify_fibonacci_mod(uint64_t const index, struct verify_prime const p)
+{
+    uint64_t const modulus = (UINT64_C(1) << p.bits) - p.c;
+    // (a, b) = (F(k), F(k+1)) for the prefixes k of index
+    uint64_t a = 0, b = 1;
+    for (int bit = 63; bit >= 0; --bit)
+    {
+        uint64_t const twice = verify_reduce((__uint128_t)2 * b + modulus - a, p);
+        uint64_t const even = verify_mul(a, twice, p);
+        uint64_t const odd = verify_reduce((__uint128_t)verify_mul(a, a, p) + verify_mul(b, b, p), p);
+        if (index >> bit & 1)
+        {
+            a = odd;
+            b = verify_reduce((__uint128_t)even + odd, p);
+        }
+        else
+        {
+            a = even;
+            b = odd;
+        }
+    }
+    return a;
+}
+
+int verify_fibonacci(uint64_t const index, struct number const num)
+{
+    uint8_t const *const bytes = num.bytes;
+    uint64_t residues[VERIFY_NPRIMES] = { 0 };
+    // 2^64 mod p
+    uint64_t radix[VERIFY_NPRIMES];
+    for (size_t i = 0; i < VERIFY_NPRIMES; ++i)
+    {
+        radix[i] = verify_reduce((__uint128_t)1 << 64, verify_primes[i]);
+    }
+
+    // Horner's rule over the 64-bit words, from the most significant one
+    // (radix and residue are small enough that r 2^64 + w fits in 128 bits,
+    // and the primes take independent chains, which overlap in the pipeline)
+    size_t offset = num.length;
+    if (offset % sizeof(uint64_t))
+    {
+        uint64_t word = 0;
+        offset -= offset % sizeof(uint64_t);
+        memcpy(&word, &bytes[offset], num.length - offset);
+        for (size_t i = 0; i < VERIFY_NPRIMES; ++i)
+        {
+            residues[i] = verify_reduce(word, verify_primes[i]);
+        }
+    }
+    while (offset)
+    {
+        uint64_t word;
+        offset -= sizeof(uint64_t);
+        memcpy(&word, &bytes[offset], sizeof(word));
+        for (size_t i = 0; i < VERIFY_NPRIMES; ++i)
+        {
+            residues[i] = verify_reduce((__uint128_t)residues[i] * radix[i] + word, verify_primes[i]);
+        }
+    }
+
+    for (size_t i = 0; i < VERIFY_NPRIMES; ++i)
+    {
+        if (residues[i] != verify_fibonacci_mod(index, verify_primes[i]))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,15 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdint.h>
+
+#include "fib_base.h"
+
+// Checks that num is F(index), modulo a few primes of 61 or 62 bits: F(index)
+// is computed modulo each of them by doubling (in O(log index)), num is
+// reduced modulo all of them in one pass over its bytes, and the residues are
+// compared. A wrong result passing all of them is (very much) a coincidence.
+// Returns 1 if num passes, 0 otherwise.
+int verify_fibonacci(uint64_t index, struct number num);
+
+#endif//VERIFY_H